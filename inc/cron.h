@@ -34,13 +34,23 @@
 #include <stddef.h>
 
 void services (void);
-void cron (void);
-uint8_t cron_stretching(void);
+
+#define SERVICE_PHASE_AUTO      ((clock_t)-1)   /*!< Let service_add_phase() pick the phase. */
+#define CRON_NOTIFY             (0x80000000)    /*!< The cron daemon's notification bit. */
+#define CRON_SLEEP_MAX          (0x3FFFFFFF)    /*!< The longest daemon sleep in ticks. Alarms work up to 2^31 ticks away. */
 
 void service_add (service_t fptr, clock_t every);
+int  service_add_phase (service_t fptr, clock_t every, clock_t phase);
+int  service_load (void);
+void service_rescale (clock_t fo, clock_t fn);
+clock_t service_next (void);
 void service_rem (service_t fptr);
+int  kinit_cron (size_t mem);
 void crontab (process_ptr_t fptr, size_t ms, int8_t nice, int8_t fit, uint8_t pr, time_t at, time_t every);
+int  crontab_expr (process_ptr_t fptr, size_t ms, int8_t nice, int8_t fit, uint8_t pr, const cron_expr_t *e);
 void crontab_r (process_ptr_t fptr);
+int  cron_parse (cron_expr_t *e, const char *s);
+time_t cron_expr_next (const cron_expr_t *e, time_t t);
 
 extern pid_t knew (process_ptr_t fptr, size_t mem, int8_t nice, int8_t fit);
 
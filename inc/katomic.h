@@ -0,0 +1,151 @@
+/*
+ * katomic.h : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+
+#ifndef __katomic_h__
+#define __katomic_h__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <kcmsis.h>
+
+/*
+ * Kernel atomics.
+ *
+ * On ARMv7-M we use LDREX/STREX loops. Any exception entry or return
+ * clears the exclusive monitor, so an ISR or a context switch between the
+ * load and the store makes the store fail and the loop retry. The
+ * operations are lock free and safe between processes and ISRs without
+ * touching BASEPRI or PRIMASK.
+ *
+ * For other targets we fall back to the compiler's __atomic builtins.
+ */
+#if defined (__ARM_ARCH_7M__) || defined (__ARM_ARCH_7EM__)
+#define KATOMIC_LDREX      (1)
+#endif
+
+/*!
+ * \brief Atomically add \a v to \a *p.
+ * \return The value of \a *p before the addition.
+ */
+static inline int katomic_fetch_add (volatile int *p, int v)
+{
+#ifdef KATOMIC_LDREX
+   int old;
+   do
+      old = (int)__kLDREXW ((volatile uint32_t*)p);
+   while (__kSTREXW ((uint32_t)(old + v), (volatile uint32_t*)p));
+   __kDMB ();
+   return old;
+#else
+   return __atomic_fetch_add (p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/*!
+ * \brief Atomically compare \a *p with \a *expected and, if equal,
+ * store \a desired. Else load the current value in \a *expected.
+ * \return true on success.
+ */
+static inline int katomic_cas (volatile int *p, int *expected, int desired)
+{
+#ifdef KATOMIC_LDREX
+   int old;
+   do {
+      old = (int)__kLDREXW ((volatile uint32_t*)p);
+      if (old != *expected) {
+         __kCLREX ();
+         *expected = old;
+         return 0;
+      }
+   } while (__kSTREXW ((uint32_t)desired, (volatile uint32_t*)p));
+   __kDMB ();
+   return 1;
+#else
+   return __atomic_compare_exchange_n (p, expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/*!
+ * \brief Atomically replace \a *p with \a v.
+ * \return The previous value of \a *p.
+ */
+static inline int katomic_xchg (volatile int *p, int v)
+{
+#ifdef KATOMIC_LDREX
+   int old;
+   do
+      old = (int)__kLDREXW ((volatile uint32_t*)p);
+   while (__kSTREXW ((uint32_t)v, (volatile uint32_t*)p));
+   __kDMB ();
+   return old;
+#else
+   return __atomic_exchange_n (p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/*!
+ * \brief Atomically OR \a v to \a *p.
+ * \return The value of \a *p before the operation.
+ */
+static inline uint32_t katomic_fetch_or (volatile uint32_t *p, uint32_t v)
+{
+#ifdef KATOMIC_LDREX
+   uint32_t old;
+   do
+      old = __kLDREXW (p);
+   while (__kSTREXW (old | v, p));
+   __kDMB ();
+   return old;
+#else
+   return __atomic_fetch_or (p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/*!
+ * \brief Atomically AND \a v to \a *p.
+ * \return The value of \a *p before the operation.
+ */
+static inline uint32_t katomic_fetch_and (volatile uint32_t *p, uint32_t v)
+{
+#ifdef KATOMIC_LDREX
+   uint32_t old;
+   do
+      old = __kLDREXW (p);
+   while (__kSTREXW (old & v, p));
+   __kDMB ();
+   return old;
+#else
+   return __atomic_fetch_and (p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif //#ifndef __katomic_h__
@@ -88,6 +88,15 @@ typedef struct
   __I  uint32_t ISAR[5];                      /*!< Offset: 0x60  ISA Feature Register                                  */
 } kSCB_Type;
 
+#define kSCB_ICSR_RETTOBASE_Pos             11                                             /*!< SCB ICSR: RETTOBASE Position */
+#define kSCB_ICSR_RETTOBASE_Msk             (1ul << kSCB_ICSR_RETTOBASE_Pos)                /*!< SCB ICSR: RETTOBASE Mask */
+
+#define kSCB_ICSR_VECTPENDING_Pos           12                                             /*!< SCB ICSR: VECTPENDING Position */
+#define kSCB_ICSR_VECTPENDING_Msk           (0x1FFul << kSCB_ICSR_VECTPENDING_Pos)          /*!< SCB ICSR: VECTPENDING Mask */
+
+#define kSCB_ICSR_PENDSTSET_Pos             26                                             /*!< SCB ICSR: PENDSTSET Position */
+#define kSCB_ICSR_PENDSTSET_Msk             (1ul << kSCB_ICSR_PENDSTSET_Pos)                /*!< SCB ICSR: PENDSTSET Mask */
+
 #define kSCB_ICSR_PENDSVSET_Pos             28                                             /*!< SCB ICSR: PENDSVSET Position */
 #define kSCB_ICSR_PENDSVSET_Msk             (1ul << kSCB_ICSR_PENDSVSET_Pos)                /*!< SCB ICSR: PENDSVSET Mask */
 
@@ -160,13 +169,37 @@ typedef struct
 
 
 
+/*!
+ * struct to access Data Watchpoint and Trace registers (cycle counter part)
+ */
+typedef struct
+{
+  __IO uint32_t CTRL;                         /*!< Offset: 0x00  DWT Control Register                 */
+  __IO uint32_t CYCCNT;                       /*!< Offset: 0x04  DWT Current Cycle Count Register     */
+} kDWT_Type;
+
+#define kDWT_CTRL_NOCYCCNT_Pos              25                                             /*!< DWT CTRL: NOCYCCNT Position */
+#define kDWT_CTRL_NOCYCCNT_Msk              (1ul << kDWT_CTRL_NOCYCCNT_Pos)                 /*!< DWT CTRL: NOCYCCNT Mask */
+
+#define kDWT_CTRL_CYCCNTENA_Pos              0                                             /*!< DWT CTRL: CYCCNTENA Position */
+#define kDWT_CTRL_CYCCNTENA_Msk             (1ul << kDWT_CTRL_CYCCNTENA_Pos)                /*!< DWT CTRL: CYCCNTENA Mask */
+
+/* Debug Exception and Monitor Control Register */
+#define kCoreDebug_DEMCR                    (*(__IO uint32_t *) 0xE000EDFC)                 /*!< CoreDebug DEMCR */
+#define kCoreDebug_DEMCR_TRCENA_Pos         24                                             /*!< CoreDebug DEMCR: TRCENA Position */
+#define kCoreDebug_DEMCR_TRCENA_Msk         (1ul << kCoreDebug_DEMCR_TRCENA_Pos)            /*!< CoreDebug DEMCR: TRCENA Mask */
+
+
+
 /* Memory mapping of Cortex-M3 Hardware */
 #define kSCS_BASE           (0xE000E000)                              /*!< System Control Space Base Address */
 #define kSysTick_BASE       (kSCS_BASE +  0x0010)                     /*!< SysTick Base Address              */
 #define kSCB_BASE           (kSCS_BASE +  0x0D00)                     /*!< System Control Block Base Address */
+#define kDWT_BASE           (0xE0001000)                              /*!< DWT Base Address                  */
 
 #define kSCB                ((kSCB_Type *)          kSCB_BASE)        /*!< SCB configuration struct          */
 #define kSysTick            ((kSysTick_Type *)      kSysTick_BASE)    /*!< SysTick configuration struct      */
+#define kDWT                ((kDWT_Type *)          kDWT_BASE)        /*!< DWT configuration struct          */
 
 
 
@@ -177,6 +210,38 @@ typedef struct
  ******************************************************************************/
 
 #define __kWFI()   __asm volatile ( "WFI    \n\t" )
+#define __kDMB()   __asm volatile ( "DMB    \n\t" ::: "memory" )
+
+/*!
+ * \brief  Exclusive load (LDREX). Marks the address for exclusive access.
+ * \param  addr  Pointer to data
+ * \return value of the data
+ */
+static inline uint32_t __kLDREXW (volatile uint32_t *addr)
+{
+   uint32_t r;
+   __asm volatile ("LDREX %0, [%1]  \n\t" : "=r" (r) : "r" (addr) : "memory" );
+   return r;
+}
+
+/*!
+ * \brief  Exclusive store (STREX). Stores only if the address is still
+ * marked for exclusive access. Any exception entry or return clears the mark.
+ * \param  value Value to store
+ * \param  addr  Pointer to data
+ * \return 0 on success, 1 if the store failed
+ */
+static inline uint32_t __kSTREXW (uint32_t value, volatile uint32_t *addr)
+{
+   uint32_t r;
+   __asm volatile ("STREX %0, %2, [%1] \n\t" : "=&r" (r) : "r" (addr), "r" (value) : "memory" );
+   return r;
+}
+
+/*!
+ * \brief  Remove the exclusive lock created by LDREX.
+ */
+#define __kCLREX() __asm volatile ( "CLREX  \n\t" ::: "memory" )
 
 
 void __kset_BASEPRI(uint32_t value)  __attribute__( ( naked ) );
@@ -189,6 +254,14 @@ void __kset_FAULTMASK(uint32_t fmsk) __attribute__( ( naked ) );
 
 uint8_t __kPrivilege(void);
 
+/* ==================    Semihosting  ================== */
+#define  KSH_OPEN       (0x01)   /*!< SYS_OPEN */
+#define  KSH_CLOSE      (0x02)   /*!< SYS_CLOSE */
+#define  KSH_WRITE      (0x05)   /*!< SYS_WRITE */
+
+int __ksemihost (int op, void *arg);
+int __ksemihost_dump (const char *file, const void *buf, uint32_t size);
+
 /*
 static __INLINE void __DSB() {
    __ASM volatile ("dsb");
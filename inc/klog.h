@@ -0,0 +1,140 @@
+/*
+ * klog.h : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+#ifndef __klog_h__
+#define __klog_h__
+
+#if defined (__cplusplus) && defined (PKERNEL_KLOG)
+#include <type_traits>     // klog() argument checks
+#endif
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <pkdefs.h>
+#include <ktime.h>
+
+#define KLOG_MAGIC         (0x474F4C4B)   /*!< "KLOG" */
+#define KLOG_VERSION       (1)
+#define KLOG_MAX_ARGS      (7)            /*!< The format id keeps the argument count in its low 3 bits */
+
+/*
+ * Deferred binary logging. Build with PKERNEL_KLOG and klog() writes
+ * only the address of its format string, the cpu cycle counter and the
+ * raw arguments to the klog_buf ring buffer. Without it klog() compiles
+ * to nothing, and its arguments are not evaluated.
+ *
+ * The format strings go to the .klog_fmt section, aligned to 8 so the
+ * low 3 bits of the address hold the argument count. The section can be
+ * kept out of flash with (INFO) in the linker script, the host reads the
+ * strings from the elf. tools/klog_decode.py formats the log.
+ *
+ * The arguments are 32-bit words: integers, characters, or pointers to
+ * constant strings in the elf for %s. Each one is cast to a word, floats
+ * and arguments wider than 32 bits fail to compile.
+ * A record costs an atomic add, a cycle counter read and 2 + n stores,
+ * it is safe from processes and ISRs.
+ */
+#ifdef PKERNEL_KLOG
+
+extern klog_t klog_buf;
+
+/*!
+ * \brief Write a record to the log ring buffer. Use it through klog().
+ * \param id  The format string address with the argument count in the low bits
+ * \param a   The arguments
+ */
+static inline void klog_write (uint32_t id, const uint32_t *a)
+{
+   uint32_t n = id & KLOG_MAX_ARGS, i;
+   uint32_t p = (uint32_t)katomic_fetch_add ((volatile int *)&klog_buf.head, n + 2);
+
+   klog_buf.w[p++ & (PKERNEL_KLOG_SIZE-1)] = id;
+   klog_buf.w[p++ & (PKERNEL_KLOG_SIZE-1)] = kcycles ();
+   for (i=0 ; i<n ; ++i)
+      klog_buf.w[p++ & (PKERNEL_KLOG_SIZE-1)] = a[i];
+}
+
+/*
+ * klog() argument helpers. __KLOG_MAP(m, ...) expands m(x) for each
+ * argument, up to KLOG_MAX_ARGS of them.
+ */
+#define __KLOG_N(...)            __KLOG_N_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define __KLOG_N_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _n, ...)   _n
+#define __KLOG_CAT(_a, _b)       __KLOG_CAT_(_a, _b)
+#define __KLOG_CAT_(_a, _b)      _a##_b
+#define __KLOG_MAP(_m, ...)      __KLOG_CAT (__KLOG_MAP_, __KLOG_N (__VA_ARGS__)) (_m, ##__VA_ARGS__)
+#define __KLOG_MAP_0(_m)
+#define __KLOG_MAP_1(_m, _x)        _m(_x)
+#define __KLOG_MAP_2(_m, _x, ...)   _m(_x) __KLOG_MAP_1 (_m, __VA_ARGS__)
+#define __KLOG_MAP_3(_m, _x, ...)   _m(_x) __KLOG_MAP_2 (_m, __VA_ARGS__)
+#define __KLOG_MAP_4(_m, _x, ...)   _m(_x) __KLOG_MAP_3 (_m, __VA_ARGS__)
+#define __KLOG_MAP_5(_m, _x, ...)   _m(_x) __KLOG_MAP_4 (_m, __VA_ARGS__)
+#define __KLOG_MAP_6(_m, _x, ...)   _m(_x) __KLOG_MAP_5 (_m, __VA_ARGS__)
+#define __KLOG_MAP_7(_m, _x, ...)   _m(_x) __KLOG_MAP_6 (_m, __VA_ARGS__)
+
+//! An argument as a log word. Pointers convert through uintptr_t, without warnings.
+#define __KLOG_WORD(_x)          (uint32_t)(uintptr_t)(_x),
+#ifdef __cplusplus
+#define __KLOG_ASSERT(_c, _msg)  static_assert (_c, _msg)
+#define __KLOG_FLOAT(_x)         (std::is_same<decltype ((_x) + 0), float>::value)
+#else
+#define __KLOG_ASSERT(_c, _msg)  _Static_assert (_c, _msg)
+#define __KLOG_FLOAT(_x)         (__builtin_types_compatible_p (__typeof__ ((_x) + 0), float))
+#endif
+//! Reject the arguments a word does not hold. (_x)+0 decays arrays and promotes chars.
+#define __KLOG_CHECK(_x)                                                   \
+   __KLOG_ASSERT (sizeof ((_x) + 0) <= 4 && !__KLOG_FLOAT (_x),            \
+      "klog: the arguments are 32-bit integers or pointers");
+
+/*!
+ * \brief Log a printf like message, formatted later on the host.
+ * \param _fmt  A string literal
+ * \param ...   Up to KLOG_MAX_ARGS 32-bit integers or pointers
+ */
+#define klog(_fmt, ...)                                                    \
+   do {                                                                    \
+      static const char __kfmt[]                                           \
+         __attribute__ ((section (".klog_fmt"), aligned (8))) = _fmt;      \
+      __KLOG_ASSERT (__KLOG_N (__VA_ARGS__) <= KLOG_MAX_ARGS,              \
+         "klog: too many arguments");                                      \
+      __KLOG_MAP (__KLOG_CHECK, ##__VA_ARGS__)                             \
+      const uint32_t __karg[] = { 0, __KLOG_MAP (__KLOG_WORD, ##__VA_ARGS__) }; \
+      klog_write ((uint32_t)(uintptr_t)__kfmt | (sizeof (__karg)/4 - 1), __karg + 1); \
+   } while (0)
+
+#else
+
+#define klog(_fmt, ...)          do { } while (0)
+
+#endif   //#ifdef PKERNEL_KLOG
+
+int klog_drain (const char *file);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif   //#ifndef __klog_h__
@@ -0,0 +1,67 @@
+/*
+ * kprof.h : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+#ifndef __kprof_h__
+#define __kprof_h__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <pkdefs.h>
+#include <ktime.h>
+
+#define KPROF_MAGIC        (0x4652504B)   /*!< "KPRF" */
+#define KPROF_VERSION      (1)
+#define KPROF_PROBE        (8)            /*!< Histogram slots to probe before a sample is lost */
+
+/*
+ * Statistical pc-sampling profiler. Build with PKERNEL_PROF and the
+ * SysTick handler samples the pc of the interrupted process from its
+ * hardware stack frame. The samples go to the kprof_buf histogram, keyed
+ * by pid and by address bucket of 2^PKERNEL_PROF_SHIFT bytes.
+ *
+ * A sample costs a hash and a few loads and stores in the SysTick ISR.
+ * Samples that interrupt an exception handler are only counted. The
+ * histogram can be read with kprof_drain() through semihosting, or from a
+ * memory dump of kprof_buf. tools/kprof.py symbolizes it against the elf.
+ */
+#ifdef PKERNEL_PROF
+
+extern kprof_t kprof_buf;
+
+void kprof_sample (void);
+
+#endif   //#ifdef PKERNEL_PROF
+
+void kprof_start (void);
+void kprof_stop (void);
+void kprof_clear (void);
+int  kprof_drain (const char *file);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif   //#ifndef __kprof_h__
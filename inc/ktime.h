@@ -48,19 +48,103 @@
 //typedef _TIME_T_ time_t;               /*!< date/time in unix secs past 1-Jan-70 type for 68 years*/
 
 extern clock_t  volatile Ticks;        /*!< CPU time */
+extern clock_t  volatile Ticks_hi;     /*!< CPU time, number of Ticks wraps. \sa clock64() */
 extern time_t   volatile Now;          /*!< time in unix secs past 1-Jan-70 */
+extern clock_t  volatile Now_left;     /*!< Ticks left until Now advances */
+
+#define KTIME_SYNC_EVERY   (64)   /*!< Default RTC resync interval in secs. \sa kset_rtc_sync() */
+#define KTIME_STEP         (2)    /*!< RTC offsets of this many secs or more are stepped, smaller are slewed. */
+#define KTIME_SLEW_DIV     (16)   /*!< Slew at most 1/KTIME_SLEW_DIV of a second per second. */
+
+#define KTIME_RELOAD_MIN   (64)   /*!< The shortest partial tick in cpu cycles when SysTick is reprogrammed. */
 
 typedef time_t (*ext_time_ft) (time_t *);    /*!< Pointer type for External time function. */
+typedef void (*kclk_switch_ft) (clock_t);    /*!< Pointer type for the cpu clock switch function. */
+typedef clock_t (*kgov_ft) (clock_t, int);   /*!< Pointer type for the clock governor policy. Gets the cpu clock and the load in %, returns the new cpu clock. */
+
+/*!
+ * Rescale the tick count \a t from tick frequency \a fo to \a fn.
+ */
+#define kticks_rescale(t, fo, fn)   ((clock_t)(((uint64_t)(t) * (fn)) / (fo)))
 typedef int (*ext_settime_ft) (const time_t *); /*!< Pointer type for External set time function. */
 
 extern ext_time_ft _ext_time;          //!< Pointer to External time callback function
 extern ext_settime_ft _ext_settime;    //!< Pointer to External set time callback function
 
+/*!
+ * True if the tick \a a comes before the tick \a b. Wrap safe for ticks
+ * up to half the clock_t range apart. clock_t is 32-bit.
+ */
+#define ktime_before(a, b) ((int32_t)((clock_t)(a) - (clock_t)(b)) < 0)
+
+/*!
+ * True if Ticks has reached the tick \a t. Wrap safe as ktime_before().
+ */
+#define ktime_passed(t)    (!ktime_before (Ticks, t))
+
+/*
+ * The masking around the Ticks wrap. A host test may replace it.
+ */
+#ifndef KTIME_IRQ_SAVE
+#define KTIME_IRQ_SAVE(_pm)      do { (_pm) = __kget_PRIMASK (); __kset_PRIMASK (1); } while (0)
+#define KTIME_IRQ_RESTORE(_pm)   __kset_PRIMASK (_pm)
+#endif
+
+/*!
+ * \brief Return the alarm tick after \a t ticks from now.
+ * Alarm 0 means no alarm, so if we land on it at the wrap we wake
+ * one tick later.
+ */
+static inline clock_t ktime_alarm (clock_t t)
+{
+   clock_t a = Ticks + t;
+   return (a) ? a : 1;
+}
+
+/*!
+ * \brief Advance the tick counter by one. Called from SysTick only.
+ *
+ * SysTick runs below the peripheral ISRs. So at the wrap both words
+ * change with PRIMASK set, and an ISR never reads the new low word with
+ * the old high word. Processes read again in clock64().
+ */
+static inline void ktime_tick (void)
+{
+   uint32_t pm;
+
+   if (Ticks != (clock_t)0xFFFFFFFF)
+      ++Ticks;
+   else {
+      KTIME_IRQ_SAVE (pm);
+      Ticks = 0;
+      ++Ticks_hi;
+      KTIME_IRQ_RESTORE (pm);
+   }
+}
+
+/*!
+ * \brief Read the 64-bit tick counter. \sa clock64()
+ */
+static inline uint64_t ktime_read64 (void)
+{
+   clock_t hi, lo;
+
+   do {
+      hi = Ticks_hi;
+      lo = Ticks;
+   } while (hi != Ticks_hi);
+   return ((uint64_t)hi << 32) | (uint32_t)lo;
+}
+
 /*
  * ========= Set Functions ============
  */
 void kset_rtc_time (ext_time_ft f);
 void kset_rtc_settime (ext_settime_ft f);
+void kset_rtc_sync (time_t every);
+void ktime_sync (void);
+void kset_governor (kgov_ft policy, kclk_switch_ft sw, clock_t window);
+void ktime_governor (void);
 
 /* =================== Exported Functions ===================== */
 
@@ -69,6 +153,7 @@ void kinit_SysTick (void);
 clock_t get_clock (void);
 void set_clock (clock_t clk);
 void update_clock (clock_t clk);
+int  kclock_change (clock_t clk, kclk_switch_ft sw);
 
 clock_t get_freq (void);
 void set_freq (clock_t f);
@@ -76,6 +161,10 @@ void update_freq (clock_t f);
 
 
 clock_t clock (void);
+uint64_t clock64 (void);
+uint32_t kcycles (void);
+uint64_t kclock_ns (void);
+int kclock_gettime (struct timespec *ts);
 time_t time(time_t * /*timer*/);
 int settime (const time_t *t);
 
@@ -0,0 +1,60 @@
+/*
+ * ktimer.h : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+#ifndef __ktimer_h__
+#define __ktimer_h__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <pkdefs.h>
+
+/*
+ * Timer wheel geometry. KTW_LEVELS levels of KTW_SIZE slots each.
+ * A timer further than 2^(KTW_BITS*KTW_LEVELS) ticks waits in the last
+ * level and cascades again until it is in range.
+ */
+#define KTW_BITS           (6)
+#define KTW_SIZE           (1 << KTW_BITS)
+#define KTW_MASK           (KTW_SIZE - 1)
+#define KTW_LEVELS         (3)
+
+#define KTIMER_NOTIFY      (0x80000000)   /*!< The notification bit of the timer daemon. */
+
+int  kinit_timers (size_t mem);
+void ktimer_tick (clock_t now);
+
+void ktimer_init (ktimer_t *t, ktimer_cb_t fptr, void *arg);
+int  ktimer_start (ktimer_t *t, clock_t ticks, clock_t period);
+void ktimer_stop (ktimer_t *t);
+int  ktimer_active (ktimer_t *t);
+void ktimer_rescale (clock_t fo, clock_t fn);
+clock_t ktimer_next (void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif   //#ifndef __ktimer_h__
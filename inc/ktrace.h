@@ -0,0 +1,82 @@
+/*
+ * ktrace.h : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+#ifndef __ktrace_h__
+#define __ktrace_h__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <pkdefs.h>
+#include <ktime.h>
+
+#define KTRACE_MAGIC       (0x4352544B)   /*!< "KTRC" */
+#define KTRACE_VERSION     (1)
+
+/*
+ * Kernel event tracing. Build with PKERNEL_TRACE to record the events in
+ * the ktrace_buf ring buffer. Without it KTRACE() compiles to nothing.
+ *
+ * An event costs an atomic increment, a cycle counter read and one 8
+ * byte store. The buffer can be read with ktrace_drain() through
+ * semihosting, or from a memory dump of ktrace_buf. tools/ktrace_decode.py
+ * turns it to a timeline and per-process statistics.
+ */
+#ifdef PKERNEL_TRACE
+
+extern ktrace_t ktrace_buf;
+
+/*!
+ * \brief Record an event in the trace ring buffer. Safe from processes and ISRs.
+ * \param ev  The event, \sa ktrace_en
+ * \param pid The process of the event
+ * \param arg The event's argument
+ */
+static inline void ktrace (uint8_t ev, uint8_t pid, uint16_t arg)
+{
+   ktrace_ev_t *e = &ktrace_buf.ev[
+      (uint32_t)katomic_fetch_add ((volatile int *)&ktrace_buf.head, 1) & (PKERNEL_TRACE_SIZE-1)];
+
+   e->ts = kcycles ();
+   e->ev = ev;
+   e->pid = pid;
+   e->arg = arg;
+}
+
+#define KTRACE(_ev, _pid, _arg)  ktrace ((uint8_t)(_ev), (uint8_t)(_pid), (uint16_t)(_arg))
+
+#else
+
+#define KTRACE(_ev, _pid, _arg)  do { } while (0)
+
+#endif   //#ifdef PKERNEL_TRACE
+
+int ktrace_drain (const char *file);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif   //#ifndef __ktrace_h__
@@ -30,6 +30,11 @@
 #include <pkdefs.h>
 #include <sched.h>
 #include <cron.h>
+#include <topic.h>
+#include <ktimer.h>
+#include <ktrace.h>
+#include <kprof.h>
+#include <klog.h>
 #include <ktime.h>
 
 /*!
@@ -73,14 +78,38 @@ typedef enum
 #define OS_PENDSV_PRI      (0x0F)
 #define OS_SYSTICK_PRI     (0x0E)
 
-#define __os_halt_ISR()                         \
+#define __os_mask_ISR()                         \
    do {                                         \
       __kset_BASEPRI ((OS_SYSTICK_PRI << (8 - __kNVIC_PRIO_BITS)) & 0xff); \
       __asm volatile( "dsb" );                  \
       __asm volatile( "isb" );                  \
    } while (0)
 
-#define __os_resume_ISR()  (__kset_BASEPRI (0))
+#define __os_unmask_ISR()  (__kset_BASEPRI (0))
+
+/*
+ * With PKERNEL_IRQLAT every masked section is timed from the mask to the
+ * unmask and charged to its call site. \sa kirqlat_get()
+ */
+#ifdef PKERNEL_IRQLAT
+#define KIRQLAT_ENTER()    kirqlat_enter (__FILE__, __LINE__)
+#define KIRQLAT_EXIT()     kirqlat_exit ()
+#else
+#define KIRQLAT_ENTER()
+#define KIRQLAT_EXIT()
+#endif
+
+#define __os_halt_ISR()                         \
+   do {                                         \
+      __os_mask_ISR();                          \
+      KIRQLAT_ENTER();                          \
+   } while (0)
+
+#define __os_resume_ISR()                       \
+   do {                                         \
+      KIRQLAT_EXIT();                           \
+      __os_unmask_ISR();                        \
+   } while (0)
 
 #define __pendsv_trig()                         \
    do {                                         \
@@ -105,10 +134,25 @@ void OS_Call (process_t *p, os_command_enum_t cmd);
  */
 void exit (int status);
 void sleep (clock_t t);
+void usleep (uint32_t us);
+uint32_t ktick_wcet (int clear);
+uint32_t kdeferred_wcet (int clear);
+void kirqlat_enter (const char *file, uint32_t line);
+void kirqlat_exit (void);
+void kirqlat_get (kirqlat_t *st, int clear);
 void sem_wait (sem_t *s);
 void sem_post (sem_t *s);
 void mut_lock (sem_t *m);
 void mut_unlock (sem_t *m);
+void cond_wait (cond_t *c, sem_t *m);
+void cond_signal (cond_t *c);
+void cond_broadcast (cond_t *c);
+void rw_rdlock (rwlock_t *l);
+void rw_wrlock (rwlock_t *l);
+int  notify (pid_t pid, uint32_t bits, notify_action_en action);
+uint32_t notify_wait (uint32_t mask, clock_t timeout);
+int  sub_read (sub_t *s, void *msg, clock_t timeout);
+int  kpoll (kpoll_t *items, int n, clock_t timeout);
 
 
 #endif //#ifndef __os_h__
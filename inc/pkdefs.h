@@ -33,22 +33,35 @@
 #include <ktime.h>
 #include <stddef.h>
 
-#ifndef __cplusplus
-#include <stdatomic.h>
-#define pkernel_atomic  _Atomic
-#else
-#define pkernel_atomic
-//^ We leave it blank to prevent C++ compilation errors when the header is in scope.
+#include <katomic.h>
+
+#define pkernel_atomic  volatile
+//^ Objects shared between processes and ISRs.
 //
-//  All the pkernel files should compile with gcc. If C++ compilation units include
-//  this header they see pkernel_atomic blank. The type remains binary compatible
-//  so no extra effort is required.
-#endif
+//  They are plain volatile words for both C and C++ compilation units, so
+//  the types are binary compatible. All read-modify-write operations on
+//  them go through the kernel atomics. \sa katomic.h
 
 /* =================== User Defines ===================== */
 
 #define  MAX_PROC                (0x10)   /*!< The maximum number of Process supported by pkernel. */
 #define  MAX_HEAP_ALLOCS         (0x20)   /*!< The maximum number of Heap allocations supported by pkernel.*/
+#define  TICKS_INIT              (0)      /*!< Ticks at boot. Set it close to (clock_t)-1 to test the wrap in simulation. */
+//#define  PKERNEL_TICKSTAT                 /*!< Measure the worst-case SysTick ISR and deferred tick work. \sa ktick_wcet(), kdeferred_wcet() */
+//#define  PKERNEL_TRACE                    /*!< Record kernel events in the trace ring buffer. \sa ktrace.h */
+#define  PKERNEL_TRACE_SIZE      (256)    /*!< Trace ring buffer events. Must be a power of 2. */
+//#define  PKERNEL_KLOG                     /*!< Deferred binary logging with klog(). \sa klog.h */
+#define  PKERNEL_KLOG_SIZE       (1024)   /*!< Log ring buffer words. Must be a power of 2. */
+//#define  PKERNEL_PROF                     /*!< Sample the interrupted pc on each SysTick. \sa kprof.h */
+#define  PKERNEL_PROF_SIZE       (512)    /*!< Profiler histogram slots. Must be a power of 2. */
+#define  PKERNEL_PROF_SHIFT      (4)      /*!< Profiler address bucket is 2^PKERNEL_PROF_SHIFT bytes. */
+//#define  PKERNEL_STACKCHECK               /*!< Check the process stack for overflow on each switch. \sa kstack_overflow() */
+#define  KSTACK_PAINT            (0xA5A5A5A5)   /*!< The pattern of the unused stack. */
+#define  KSTACK_SCAN_WORDS       (16)     /*!< The stack words the idle checks per loop. */
+#define  KSTACK_MARGIN           (25)     /*!< Safety margin in % of the high water mark, for the reclaim report. */
+//#define  PKERNEL_LOCKSTAT                 /*!< Count the lock acquisitions and waits. \sa klock_stats() */
+//#define  PKERNEL_IRQLAT                   /*!< Measure the interrupt masked sections. \sa kirqlat_get() */
+#define  KIRQLAT_BINS            (16)     /*!< Histogram bins of the masked durations, in powers of 2 cycles. */
 
 
 
@@ -57,6 +70,7 @@
 /* ================     General Defines       ======================*/
 #define  ALLOC_SIZE                       (MAX_HEAP_ALLOCS+MAX_PROC)
 #define  IDLE_STACK_SIZE                  (96)  // [bytes]
+#define  CRON_STACK_SIZE                  (512) // [bytes] The cron daemon, if the first crontab() starts it
 
 
 
@@ -64,11 +78,110 @@
 
 /*!
  * Semaphore data type
+ * \note A static mutex starts with { .val = 1 }, or with mut_init(). Its
+ *    contention statistics are attached only with mut_stat().
  */
 typedef struct sem {
     pkernel_atomic int val;   /*!< Semaphore value. */
+#ifdef PKERNEL_LOCKSTAT
+    struct klockstat *stat;   /*!< The mutex's contention statistics, or NULL. \sa mut_stat() */
+#endif
 }sem_t;
 
+/*!
+ * Condition variable data type
+ */
+typedef struct cond {
+    pkernel_atomic int waiters;  /*!< Number of processes waiting on the condition. */
+    pkernel_atomic int signals;  /*!< Pending wake ups, not yet consumed by the scheduler. */
+}cond_t;
+
+/*!
+ * Reader-writer lock data type
+ */
+typedef struct rwlock {
+    pkernel_atomic int readers;  /*!< Number of readers holding the lock. */
+    pkernel_atomic int writer;   /*!< Set when a writer holds, or drains, the lock. */
+    pkernel_atomic int wwait;    /*!< Number of writers waiting for the lock. */
+}rwlock_t;
+
+/*!
+ * Publish/subscribe topic data type. The publisher writes each message once
+ * in the shared ring and each subscriber reads it with its own cursor.
+ */
+typedef struct topic {
+    uint8_t     *buf;      /*!< The shared ring. It holds \a depth messages of \a size bytes. */
+    size_t      size;      /*!< The size of each message in bytes. */
+    uint32_t    depth;     /*!< The number of messages in the ring, a power of 2. */
+    pkernel_atomic uint32_t head;  /*!< Sequence number of the next message to publish. */
+}topic_t;
+
+/*!
+ * Topic subscriber data type
+ */
+typedef struct subscriber {
+    topic_t     *topic;    /*!< The topic we subscribe to. */
+    uint32_t    cursor;    /*!< Sequence number of the next message to read. */
+    uint32_t    overrun;   /*!< Number of messages lost because the subscriber was slow. */
+}sub_t;
+
+/*!
+ * The kernel object types kpoll() can wait for.
+ */
+typedef enum
+{
+   POLL_SEM=0,    /*!< Ready when the semaphore is positive. The semaphore is decreased. */
+   POLL_MUT,      /*!< Ready when the mutex is unlocked. The mutex is locked. */
+   POLL_NOTIFY,   /*!< Ready when any of the bits in mask is notified. The bits are cleared. */
+   POLL_TOPIC     /*!< Ready when the subscriber has a message. The message is not read. */
+}poll_en;
+
+/*!
+ * kpoll() item. One for each object the process waits for.
+ */
+typedef struct kpoll
+{
+   uint8_t     type;    /*!< The type of \a obj. \sa poll_en */
+   void        *obj;    /*!< Pointer to the sem_t or sub_t. Not used for POLL_NOTIFY. */
+   uint32_t    mask;    /*!< The notification bits for POLL_NOTIFY. */
+   uint32_t    got;     /*!< The notification bits taken for POLL_NOTIFY. */
+}kpoll_t;
+
+/*!
+ * The set of items a process waits for inside kpoll().
+ */
+typedef struct kpollset
+{
+   kpoll_t     *items;
+   int         n;
+}kpollset_t;
+
+/*!
+ * Kernel objects a process can be suspended on, beside the
+ * semaphore and the alarm. \sa process_t
+ */
+typedef enum
+{
+   WAIT_NONE=0,
+   WAIT_COND,
+   WAIT_RDLOCK,   /*!< Reader waits for the writers to leave. */
+   WAIT_WRLOCK,   /*!< Writer waits for the lock to become free. */
+   WAIT_WRDRAIN,  /*!< Writer holds the lock and waits for the readers to leave. */
+   WAIT_NOTIFY,   /*!< Process waits for notification bits. \sa notify() */
+   WAIT_TOPIC,    /*!< Subscriber waits for a new message. */
+   WAIT_POLL      /*!< Process waits for any object in a kpollset_t. */
+}wait_en;
+
+/*!
+ * The way notify() updates the notification value of the target process.
+ */
+typedef enum
+{
+   NOTIFY_SET_BITS=0,   /*!< OR the bits to the notification value. */
+   NOTIFY_INCREMENT,    /*!< Increase the notification value by one. The bits are discarded. */
+   NOTIFY_OVERWRITE     /*!< Replace the notification value with the bits. */
+}notify_action_en;
+
 /*!
  * Hardware stack frame.
  * This is a clone of the stack frame used by NVIC
@@ -109,6 +222,9 @@ typedef struct
 {
    uint32_t sp_tip;     /*!< Memory pointer returned by allocator. */
    uint32_t sp;         /*!< Current SP. */
+   uint32_t size;       /*!< The stack size in bytes. */
+   uint32_t free;       /*!< The stack words from sp_tip never used so far. \sa kstack_stats() */
+   uint32_t scan;       /*!< The stack scan cursor, in words from sp_tip. */
 }proc_tcb_t;
 
 typedef int pid_t;      /*!< Process ID type. */
@@ -132,8 +248,20 @@ typedef struct process
 
    clock_t        alarm;   /*!< If suspend this is the alarm. */
    sem_t          *sem;    /*!< If suspend this is the semaphore. */
+   uint8_t        wait;    /*!< If suspend this is the type of wobj. \sa wait_en */
+   void           *wobj;   /*!< If suspend this is the kernel object. */
+   uint8_t        susp;    /*!< Set while the process is in susq. */
+
+   pkernel_atomic uint32_t notify;  /*!< The notification value. \sa notify() */
+   uint32_t       nmask;   /*!< If suspend by notify_wait() this is the bits we wait for. */
    proc_tcb_t     tcb;
 
+   uint64_t       runtime; /*!< The cpu cycles the process has run. \sa ktop() */
+   uint64_t       rt_snap; /*!< runtime at the last ktop() */
+   uint32_t       nsw;     /*!< The times the process was switched in. */
+   uint32_t       nvcsw;   /*!< The times the process gave up the cpu (suspend, exit). */
+   uint32_t       nivcsw;  /*!< The times the process was preempted. */
+
    struct process *next, *prev;  /*!< Used by runq and susq lists. */
 }process_t;
 
@@ -146,6 +274,30 @@ typedef struct proc_list
    process_t *tail;
 }proc_list_t;
 
+/*!
+ * Circular doubly linked list node. An empty list, or a node
+ * out of any list, points to itself.
+ */
+typedef struct klist
+{
+   struct klist *next, *prev;
+}klist_t;
+
+typedef void (*ktimer_cb_t) (void *arg);
+   /*!< Pointer to software timer call-back function */
+
+/*!
+ * Software timer data type
+ */
+typedef struct ktimer
+{
+   klist_t        node;    /*!< The timer wheel slot we are in. Must be first. */
+   ktimer_cb_t    fptr;    /*!< The call-back function. */
+   void           *arg;    /*!< The call-back argument. */
+   clock_t        expire;  /*!< The tick the timer fires. */
+   clock_t        period;  /*!< The reload period in ticks, or 0 for one shot timer. */
+}ktimer_t;
+
 typedef void (*service_t) (void);
    /*!< Pointer to void function (void) to use as service */
 
@@ -156,6 +308,8 @@ typedef struct service_item
 {
    service_t      fptr;
    clock_t        every;
+   clock_t        phase;   /*!< Runs at the ticks where Ticks % every == phase. */
+   clock_t        due;     /*!< The next tick to run. */
    struct service_item  *prev, *next;
 }service_item_t;
 
@@ -166,6 +320,158 @@ typedef struct service_list
    service_item_t *tail;
 }service_list_t;
 
+/*!
+ * Calendar cron expression. Each field is a bit mask of the values
+ * that match, as in the crontab(5) "min hour mday month wday" form.
+ */
+typedef struct cron_expr
+{
+   uint64_t       minute;    /*!< bits 0-59 */
+   uint32_t       hour;      /*!< bits 0-23 */
+   uint32_t       mday;      /*!< bits 1-31 */
+   uint16_t       month;     /*!< bits 1-12 */
+   uint8_t        wday;      /*!< bits 0-6, 0 is Sunday */
+}cron_expr_t;
+
+/*!
+ * Kernel trace events. \sa ktrace.h
+ */
+typedef enum
+{
+   KTR_SWITCH=1,  /*!< Context switch. pid is the process in, arg the process out. */
+   KTR_WAKE,      /*!< A process left susq. arg is the wait_en it was waiting. */
+   KTR_CALL,      /*!< OS_Call(). arg is the os_command_enum_t. */
+   KTR_ALLOC,     /*!< malloc(). arg is the size, saturated to 0xFFFF. */
+   KTR_FREE,      /*!< free(). */
+   KTR_SERVICE,   /*!< A service run. arg is the low half of its address. */
+   KTR_CRON,      /*!< cron created a process. pid is the new process. */
+   KTR_USER=0x80  /*!< The first user event. */
+}ktrace_en;
+
+/*!
+ * Kernel trace event record, 8 bytes.
+ */
+typedef struct ktrace_ev
+{
+   uint32_t    ts;         /*!< The cpu cycle counter. \sa kcycles() */
+   uint8_t     ev;         /*!< ktrace_en */
+   uint8_t     pid;
+   uint16_t    arg;
+}ktrace_ev_t;
+
+/*!
+ * Kernel trace ring buffer. The header lets a host decoder read it from a
+ * raw memory dump as well.
+ */
+typedef struct ktrace
+{
+   uint32_t    magic;      /*!< KTRACE_MAGIC */
+   uint16_t    version;
+   uint16_t    rec;        /*!< sizeof (ktrace_ev_t) */
+   uint32_t    size;       /*!< The ring size in events */
+   pkernel_atomic uint32_t head;   /*!< The number of events ever written */
+   uint32_t    clk;        /*!< The cpu clock, for the decoder */
+   ktrace_ev_t ev[PKERNEL_TRACE_SIZE];
+}ktrace_t;
+
+/*!
+ * Deferred log ring buffer. A record is the format id, the cpu cycle
+ * counter and the raw arguments, one word each. The header lets a host
+ * decoder read it from a raw memory dump as well.
+ */
+typedef struct klog
+{
+   uint32_t    magic;      /*!< KLOG_MAGIC */
+   uint16_t    version;
+   uint16_t    rec;        /*!< The word size */
+   uint32_t    size;       /*!< The ring size in words */
+   pkernel_atomic uint32_t head;   /*!< The number of words ever written */
+   uint32_t    clk;        /*!< The cpu clock, for the decoder */
+   uint32_t    w[PKERNEL_KLOG_SIZE];
+}klog_t;
+
+/*!
+ * Profiler histogram slot, 8 bytes. An empty slot has cnt 0.
+ */
+typedef struct kprof_ent
+{
+   uint32_t    pc;         /*!< The bucket's first address */
+   uint16_t    pid;
+   uint16_t    cnt;        /*!< The samples, saturates at 0xFFFF */
+}kprof_ent_t;
+
+/*!
+ * Profiler histogram. The header lets a host tool read it from a raw
+ * memory dump as well.
+ */
+typedef struct kprof
+{
+   uint32_t    magic;      /*!< KPROF_MAGIC */
+   uint16_t    version;
+   uint16_t    rec;        /*!< sizeof (kprof_ent_t) */
+   uint32_t    size;       /*!< The histogram size in slots */
+   uint32_t    shift;      /*!< The address bucket is 2^shift bytes */
+   uint32_t    hz;         /*!< The sample rate, for the decoder */
+   uint32_t    samples;    /*!< All the samples taken */
+   uint32_t    isr;        /*!< Samples that hit an exception handler */
+   uint32_t    lost;       /*!< Samples with no free slot */
+   volatile uint8_t on;
+   kprof_ent_t ent[PKERNEL_PROF_SIZE];
+}kprof_t;
+
+/*!
+ * Process cpu statistics. \sa ktop()
+ */
+typedef struct kproc_stat
+{
+   pid_t          pid;
+   process_ptr_t  fptr;
+   uint64_t       runtime; /*!< The cpu cycles the process has run */
+   uint16_t       share;   /*!< The cpu share since the last ktop(), in 0.1% */
+   uint32_t       nsw;     /*!< Switched in */
+   uint32_t       nvcsw;   /*!< Voluntary switches out */
+   uint32_t       nivcsw;  /*!< Involuntary switches out */
+}kproc_stat_t;
+
+/*!
+ * Process stack statistics. \sa kstack_stats()
+ */
+typedef struct kstack_stat
+{
+   pid_t          pid;
+   process_ptr_t  fptr;
+   uint32_t       size;    /*!< The stack size in bytes */
+   uint32_t       used;    /*!< The high water mark in bytes */
+   uint32_t       reclaim; /*!< The bytes over the high water mark plus KSTACK_MARGIN */
+}kstack_stat_t;
+
+/*!
+ * Lock contention statistics. \sa mut_stat(), klock_stats()
+ */
+typedef struct klockstat
+{
+   const char     *name;
+   uint32_t       acq;        /*!< The acquisitions */
+   uint32_t       contended;  /*!< The acquisitions that had to wait */
+   uint64_t       wait_ns;    /*!< The total wait */
+   uint64_t       max_ns;     /*!< The longest wait */
+   pid_t          max_pid;    /*!< The process of the longest wait */
+   struct klockstat *next;    /*!< The registered statistics list */
+}klockstat_t;
+
+/*!
+ * Interrupt masked sections statistics. \sa kirqlat_get()
+ */
+typedef struct kirqlat
+{
+   uint32_t    count;      /*!< The masked sections */
+   uint64_t    total;      /*!< Their sum in cpu cycles */
+   uint32_t    max;        /*!< The longest in cpu cycles */
+   const char  *file;      /*!< The call site of the longest */
+   uint32_t    line;
+   uint32_t    hist[KIRQLAT_BINS];  /*!< Bin i counts [2^i, 2^(i+1)) cycles. The last bin counts the rest. */
+}kirqlat_t;
+
 /*!
  * Type for cron item
  */
@@ -176,7 +482,10 @@ typedef struct cron
    int8_t         nice, fit;
    uint8_t        pr;
    time_t         at;
-   time_t         every;
+   time_t         every;     /*!< The period in secs, 0 for one-shot. */
+   time_t         next_t;    /*!< The next fire time. */
+   uint8_t        cal;       /*!< Set if the entry uses \a expr instead of \a at and \a every. */
+   cron_expr_t    expr;
    struct cron    *prev, *next;
 }cron_t;
 
@@ -190,8 +499,10 @@ typedef enum
 {
    IDLE_RUN=0,
    IDLE_SLEEP,
-   IDLE_STOP
+   IDLE_STOP,
+   IDLE_AUTO      /*!< Let the idle governor pick the mode. \sa pm_auto() */
 }idle_mode_en;
+#define IDLE_MODES      (IDLE_STOP+1)     /*!< The number of the real idle modes */
 
 
 typedef struct kernel_vars {
@@ -199,10 +510,11 @@ typedef struct kernel_vars {
     int             def_time_slice;
     pid_t           cur_pid;    /*!< pid of the currently executing process. The idle process's cur_pid is 0.*/
     pid_t           last_pid;   /*!< pid of the last real process that was running, this should never become 0. */
-    volatile uint8_t prock;     /*!< proc lock flag. Set proc table is used. */
-    volatile uint8_t cron_stretch;
-    volatile uint8_t service_lock;
+    pkernel_atomic int prock;   /*!< proc lock flag. Set proc table is used. */
+    pkernel_atomic int service_lock;   /*!< Nesting count. While set services() does not run. */
     volatile uint8_t enable;    /*!< pkernel enable flag */
+    pkernel_atomic uint32_t notified;  /*!< One bit per pid with a pending notification. MAX_PROC must fit. */
+    volatile clock_t idle_ticks;       /*!< The ticks found the runq empty. \sa ktime_governor() */
 }kernel_var_t;
 extern kernel_var_t   kernel_vars;
 
@@ -216,6 +528,52 @@ typedef struct callbacks
    callback_t  poststop;
 }callbacks_t;
 
+/*!
+ * The cost of an idle mode, for the idle governor
+ */
+typedef struct pm_lat
+{
+   uint32_t    entry_us;   /*!< The time to enter the mode */
+   uint32_t    exit_us;    /*!< The time to wake up from the mode */
+   uint8_t     valid;      /*!< Set if the governor may use the mode */
+}pm_lat_t;
+
+/*!
+ * Power modes for the residency accounting. The first ones match idle_mode_en.
+ */
+typedef enum
+{
+   PM_RUN=0,
+   PM_SLEEP,
+   PM_STOP,
+   PM_SERVICE,
+   PM_MODES
+}pm_mode_en;
+
+#define PM_WAKE_SRC     (64)     /*!< Wake-up sources counted by exception number. The last one counts the rest. */
+
+/*!
+ * Residency of a power mode
+ */
+typedef struct pm_res
+{
+   uint32_t    entries;    /*!< The times we entered the mode */
+   uint64_t    time_us;    /*!< The time we stayed in the mode */
+   uint64_t    charge_nc;  /*!< The estimated charge, from the current model. \sa set_pm_current() */
+}pm_res_t;
+
+/*!
+ * Power management statistics
+ */
+typedef struct pm_stats
+{
+   uint32_t    chosen[IDLE_MODES];  /*!< The times the idle governor picked each mode */
+   pm_res_t    res[PM_MODES];       /*!< The residency of each mode. PM_RUN is the rest of the time. */
+   uint32_t    wake[PM_WAKE_SRC];   /*!< The wake-ups from sleep and stop, by exception number (16 + IRQn) */
+   uint16_t    last_wake;           /*!< The exception number of the last wake-up */
+   uint64_t    charge_nc;           /*!< The total estimated charge */
+}pm_stats_t;
+
 
 #ifdef __cplusplus
 }
@@ -74,14 +74,23 @@ pid_t knew (process_ptr_t fptr, size_t mem, int8_t nice, int8_t fit);
 void  kinit_ticks (clock_t clk, clock_t os_f);
 int   kinit_allocation (size_t kmsize);
 void  krun (void);
+int   kinit_timers (size_t mem);
+int   kinit_cron (size_t mem);
 
 extern clock_t clock (void);
+extern uint64_t clock64 (void);
+extern uint32_t kcycles (void);
+extern uint64_t kclock_ns (void);
+extern int kclock_gettime (struct timespec *ts);
+extern void kset_rtc_sync (time_t every);
 extern time_t time (time_t *timer);
 extern int settime (const time_t *t);
 
 extern clock_t get_clock (void);
 extern void    set_clock (clock_t clk);
 extern void    update_clock (clock_t clk);
+extern int     kclock_change (clock_t clk, kclk_switch_ft sw);
+extern void    kset_governor (kgov_ft policy, kclk_switch_ft sw, clock_t window);
 extern clock_t get_freq (void);
 extern void    set_freq (clock_t f);
 extern void    update_freq (clock_t f);
@@ -93,13 +102,42 @@ extern int  sem_check (sem_t *s);
 extern void mut_init (sem_t* m);
 extern int  mut_close (sem_t *m);
 extern int  mut_trylock (sem_t *m);
+extern void mut_stat (sem_t *m, klockstat_t *st, const char *name);
+extern int  klock_stats (klockstat_t *st, int n, int clear);
+extern void cond_init (cond_t *c);
+extern int  cond_close (cond_t *c);
+extern void rw_init (rwlock_t *l);
+extern int  rw_close (rwlock_t *l);
+extern int  rw_tryrdlock (rwlock_t *l);
+extern int  rw_trywrlock (rwlock_t *l);
+extern void rw_rdunlock (rwlock_t *l);
+extern void rw_wrunlock (rwlock_t *l);
+extern int  topic_init (topic_t *t, void *buf, size_t size, uint32_t depth);
+extern int  topic_close (topic_t *t);
+extern void publish (topic_t *t, const void *msg);
+extern void sub_init (sub_t *s, topic_t *t);
+extern int  sub_available (sub_t *s);
+extern int  sub_tryread (sub_t *s, void *msg);
 
 extern void exit (int status);
 extern void sleep (clock_t t);
+extern void usleep (uint32_t us);
+extern uint32_t ktick_wcet (int clear);
+extern uint32_t kdeferred_wcet (int clear);
+extern void kirqlat_get (kirqlat_t *st, int clear);
 extern void sem_wait (sem_t *s);
 extern void sem_post (sem_t *s);
 extern void mut_lock (sem_t *s);
 extern void mut_unlock (sem_t *m);
+extern void cond_wait (cond_t *c, sem_t *m);
+extern void cond_signal (cond_t *c);
+extern void cond_broadcast (cond_t *c);
+extern void rw_rdlock (rwlock_t *l);
+extern void rw_wrlock (rwlock_t *l);
+extern int  notify (pid_t pid, uint32_t bits, notify_action_en action);
+extern uint32_t notify_wait (uint32_t mask, clock_t timeout);
+extern int  sub_read (sub_t *s, void *msg, clock_t timeout);
+extern int  kpoll (kpoll_t *items, int n, clock_t timeout);
 
 extern void *malloc (size_t __size);
 extern void free (void* p);
@@ -107,9 +145,19 @@ extern void *calloc (size_t N, size_t __size);
 extern void *realloc (void * __r, size_t __size);
 
 extern void service_add (service_t fptr, clock_t every);
+extern int  service_add_phase (service_t fptr, clock_t every, clock_t phase);
+extern int  service_load (void);
 extern void service_rem (service_t fptr);
 extern void crontab (process_ptr_t fptr, size_t ms, int8_t nice, int8_t fit, uint8_t pr, time_t at, time_t every);
+extern int  crontab_expr (process_ptr_t fptr, size_t ms, int8_t nice, int8_t fit, uint8_t pr, const cron_expr_t *e);
 extern void crontab_r (process_ptr_t fptr);
+extern int  cron_parse (cron_expr_t *e, const char *s);
+extern time_t cron_expr_next (const cron_expr_t *e, time_t t);
+
+extern void ktimer_init (ktimer_t *t, ktimer_cb_t fptr, void *arg);
+extern int  ktimer_start (ktimer_t *t, clock_t ticks, clock_t period);
+extern void ktimer_stop (ktimer_t *t);
+extern int  ktimer_active (ktimer_t *t);
 
 extern void sleepmode (void);
 extern void stopmode (void);
@@ -120,6 +168,19 @@ extern void set_presleep (callback_t fptr);
 extern void set_postsleep (callback_t fptr);
 extern void set_prestop (callback_t fptr);
 extern void set_poststop (callback_t fptr);
+extern int  ktrace_drain (const char *file);
+extern int  klog_drain (const char *file);
+extern void kprof_start (void);
+extern void kprof_stop (void);
+extern void kprof_clear (void);
+extern int  kprof_drain (const char *file);
+extern int  ktop (kproc_stat_t *st, int n, uint16_t *idle);
+extern int  kstack_stats (kstack_stat_t *st, int n, uint32_t *reclaim);
+extern void set_pm_latency (idle_mode_en mode, uint32_t entry_us, uint32_t exit_us);
+extern clock_t pm_slack (void);
+extern void set_pm_current (pm_mode_en mode, uint32_t ua);
+extern void pm_get_stats (pm_stats_t *st);
+extern void pm_clear_stats (void);
 
 #ifdef __cplusplus
 }
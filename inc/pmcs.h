@@ -41,6 +41,13 @@ void set_postsleep (callback_t fptr);
 void set_prestop (callback_t fptr);
 void set_poststop (callback_t fptr);
 
+void set_pm_latency (idle_mode_en mode, uint32_t entry_us, uint32_t exit_us);
+clock_t pm_slack (void);
+void pm_auto (void);
+void set_pm_current (pm_mode_en mode, uint32_t ua);
+void pm_get_stats (pm_stats_t *st);
+void pm_clear_stats (void);
+
 #ifdef __cplusplus
  }
 #endif
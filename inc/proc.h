@@ -72,6 +72,11 @@ pid_t    proc_newproc (process_ptr_t fptr, size_t mem, int8_t nice, int8_t fit);
 void     proc_exit (process_t *p);
 void     proc_rst_ticks (pid_t pid);
 void     proc_dec_ticks (pid_t pid);
+void     proc_account (pid_t pid);
+int      ktop (kproc_stat_t *st, int n, uint16_t *idle);
+void     proc_stack_scan (void);
+int      kstack_stats (kstack_stat_t *st, int n, uint32_t *reclaim);
+void     kstack_overflow (pid_t pid);
 
 #endif //#ifndef __proc_h__
 
@@ -41,6 +41,8 @@ void sch_list_remove (proc_list_t *list, process_t *proc);
 void sch_susp_proc (process_t *p);
 void sch_exit (process_t *p);
 int sch_runq_empty (void);
+void sch_rescale (clock_t fo, clock_t fn);
+clock_t sch_next_alarm (void);
 int sch_susq_empty (void);
 int sch_empty_list (proc_list_t *l);
 
@@ -36,6 +36,24 @@ int  sem_check (sem_t *s);
 void mut_init (sem_t* m);
 int  mut_close (sem_t *m);
 int  mut_trylock (sem_t *m);
+void mut_stat (sem_t *m, klockstat_t *st, const char *name);
+void klock_account (klockstat_t *st, int contended, uint64_t ns);
+int  klock_stats (klockstat_t *st, int n, int clear);
+
+#ifdef PKERNEL_LOCKSTAT
+extern klockstat_t __malloc_lockstat;
+extern klockstat_t __proc_lockstat;
+#endif
+
+void cond_init (cond_t *c);
+int  cond_close (cond_t *c);
+
+void rw_init (rwlock_t *l);
+int  rw_close (rwlock_t *l);
+int  rw_tryrdlock (rwlock_t *l);
+int  rw_trywrlock (rwlock_t *l);
+void rw_rdunlock (rwlock_t *l);
+void rw_wrunlock (rwlock_t *l);
 
 #endif //#ifndef __sem_h__
 
@@ -0,0 +1,39 @@
+/*
+ * topic.h : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+
+#ifndef __topic_h__
+#define __topic_h__
+
+#include <sched.h>
+
+int  topic_init (topic_t *t, void *buf, size_t size, uint32_t depth);
+int  topic_close (topic_t *t);
+void publish (topic_t *t, const void *msg);
+
+void sub_init (sub_t *s, topic_t *t);
+int  sub_available (sub_t *s);
+int  sub_tryread (sub_t *s, void *msg);
+
+#endif //#ifndef __topic_h__
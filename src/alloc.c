@@ -23,10 +23,15 @@
  */
 
 #include <alloc.h>
+#include <ktrace.h>
+#include <sem.h>
 
 
 static al_t al[ALLOC_SIZE];      /*!< Allocation table to hold the allocated ram blocks for stack or heap. */
-static uint8_t malock = 0;       /*!< permit malloc before pkernel boot */
+static pkernel_atomic int malock = 0;   /*!< permit malloc before pkernel boot */
+#ifdef PKERNEL_LOCKSTAT
+klockstat_t __malloc_lockstat = { .name = "__malloc_lock" };  /*!< malock contention */
+#endif
 static uint8_t al_boot_f = 0;    /*!< Flag to permit stack allocation before pkernel_run */
 
 /*=============  Static Functions ====================*/
@@ -95,9 +100,23 @@ static void al_short (void)
  */
 void __malloc_lock (void)
 {
-   while (malock == 1)
-      ;
-   malock = 1;
+   int l;
+#ifdef PKERNEL_LOCKSTAT
+   uint64_t t;
+
+   l = 0;
+   if (katomic_cas (&malock, &l, 1)) {
+      klock_account (&__malloc_lockstat, 0, 0);
+      return;
+   }
+   t = kclock_ns ();
+#endif
+   do
+      l = 0;
+   while (!katomic_cas (&malock, &l, 1));
+#ifdef PKERNEL_LOCKSTAT
+   klock_account (&__malloc_lockstat, 1, kclock_ns () - t);
+#endif
 }
 
 /*!
@@ -106,7 +125,7 @@ void __malloc_lock (void)
  * \return None
  */
 inline void __malloc_unlock (void){
-   malock = 0;
+   katomic_xchg (&malock, 0);
 }
 
 /*!
@@ -261,6 +280,7 @@ caddr_t _sbrk ( int incr )
 void *malloc (size_t __size)
 {
    void * p;
+   KTRACE (KTR_ALLOC, kernel_vars.cur_pid, (__size > 0xFFFF) ? 0xFFFF : __size);
    __malloc_lock ();
    p = m_al (__size, AL_HEAP);
    __malloc_unlock ();
@@ -276,6 +296,7 @@ void *malloc (size_t __size)
  */
 void free (void* p)
 {
+   KTRACE (KTR_FREE, kernel_vars.cur_pid, 0);
    __malloc_lock ();
    m_fr (p);
    __malloc_unlock ();
@@ -294,6 +315,7 @@ void *calloc (size_t N, size_t __size)
 {
    char *p;
 
+   KTRACE (KTR_ALLOC, kernel_vars.cur_pid, (N*__size > 0xFFFF) ? 0xFFFF : N*__size);
    __malloc_lock ();
    p = m_al (N*__size, AL_HEAP);
    al_zeropad (p, N*__size);
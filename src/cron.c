@@ -23,10 +23,117 @@
  */
 
 #include <cron.h>
+#include <os.h>
+#include <ktrace.h>
 
 static service_list_t  servl;
+static service_item_t  *serv_cur;   /*!< The service services() runs, NULL if it removed itself */
 static cron_list_t     cronl;
 
+/*!
+ * The cron daemon state. The lock protects the cron list.
+ */
+static struct
+{
+   sem_t    lock;
+   pid_t    daemon;     /*!< The cron daemon's pid, 0 before kinit_cron(). */
+}cr = { .lock = { .val = 1 } };
+
+/*!
+ * \brief   Lock the service list against services(), which reorders it
+ * from PendSV. It nests. It's OK to loose "some" ticks while we hold it.
+ */
+static void serv_lock (void)
+{
+   katomic_fetch_add (&kernel_vars.service_lock, 1);
+}
+
+static void serv_unlock (void)
+{
+   katomic_fetch_add (&kernel_vars.service_lock, -1);
+}
+
+/*!
+ * \brief   Insert a service node in the service list, ordered by due tick.
+ * Nodes with the same due tick keep their insertion order.
+ * \param   m  Pointer to the service node
+ */
+static void serv_ins (service_item_t *m)
+{
+   service_item_t *p;
+
+   // Find the first node due after m
+   for (p=servl.head ; p && !ktime_before (m->due, p->due) ; p=p->next)
+      ;
+   m->next = p;
+   if (p) {
+      m->prev = p->prev;
+      p->prev = m;
+   }
+   else {
+      m->prev = servl.tail;
+      servl.tail = m;
+   }
+   if (m->prev)
+      m->prev->next = m;
+   else
+      servl.head = m;
+}
+
+/*!
+ * \brief   Remove a service node from the service list.
+ * \param   m  Pointer to the service node
+ */
+static void serv_remove (service_item_t *m)
+{
+   if(m->prev)
+      m->prev->next = m->next;
+   if(m->next)
+      m->next->prev = m->prev;
+   if(servl.head == m)
+      servl.head = m->next;
+   if(servl.tail == m)
+      servl.tail = m->prev;
+}
+
+/*!
+ * \brief   Greatest common divisor
+ */
+static clock_t serv_gcd (clock_t a, clock_t b)
+{
+   clock_t r;
+
+   while (b) {
+      r = a % b;
+      a = b;
+      b = r;
+   }
+   return a;
+}
+
+/*!
+ * \brief   Count the services of the list that run at least once in the
+ * same tick with a service of period \a every and phase \a phase.
+ *
+ * Two services meet iff their phases are equal modulo the gcd of their
+ * periods. Call with the service list locked.
+ */
+static int serv_conflicts (clock_t every, clock_t phase, service_item_t *self)
+{
+   service_item_t *m;
+   clock_t g;
+   int n = 0;
+
+   for (m=servl.head ; m ; m=m->next) {
+      if (m == self)
+         continue;
+      g = serv_gcd (every, m->every);
+      if ((phase % g) == (m->phase % g))
+         ++n;
+   }
+   return n;
+}
+
 /*!
  * \brief   Adds a function to Service list
  * \param   pfun  Pointer to function
@@ -38,148 +145,437 @@ static cron_list_t     cronl;
  */
 void service_add (service_t fptr, clock_t every)
 {
-   service_item_t *m = (service_item_t *) malloc (sizeof (service_item_t));
-
-   if (!m)  // check for free space
-      return;
+   service_add_phase (fptr, every, 0);
+}
 
-   // Add the service node to the service list
-   kernel_vars.service_lock = 1;
-   /*
-    * Service lock for list manipulation.
-    * It's OK to loose "some" ticks when we configure services.
-    */
-   if(!servl.head)
-      servl.head = m;
-   else
-      servl.tail->next = m;
+/*!
+ * \brief   Adds a function to Service list with a phase offset.
+ * \param   pfun  Pointer to function
+ * \param   every Tick period. pkernel will run the \a fptr every \b every Ticks
+ * \param   phase Tick offset inside the period. pkernel will run the \a fptr
+ *                at the ticks where Ticks % every == phase.
+ *                Use \b SERVICE_PHASE_AUTO to let pkernel pick the phase that
+ *                meets the less services, so the per-tick load is spread.
+ * \return  The worst-case per-tick service load after the add, \sa service_load(),
+ *          or -1 on failure.
+ *
+ * \note
+ *    All the entries will run in privileged mode and will use the main
+ *    stack.
+ */
+int service_add_phase (service_t fptr, clock_t every, clock_t phase)
+{
+   service_item_t *m;
+   clock_t ph;
+   int n, min;
 
-   m->next = 0;
-   m->prev = servl.tail;
-   servl.tail = m;
+   if (!every)
+      return -1;
+   if (!(m = (service_item_t *) malloc (sizeof (service_item_t))))
+      return -1;  // check for free space
 
+   serv_lock ();
+   if (phase == SERVICE_PHASE_AUTO) {
+      // Try every phase of the period and keep the first with the less conflicts
+      for (phase=0, ph=0, min=-1 ; ph<every && min ; ++ph)
+         if ((n = serv_conflicts (every, ph, 0)) < min || min < 0) {
+            min = n;
+            phase = ph;
+         }
+   }
    // Fill micron values
    m->every = every;
+   m->phase = phase % every;
    m->fptr = fptr;
-   kernel_vars.service_lock = 0;
+
+   // Add the service node to the service list
+   m->due = Ticks - ((Ticks % every) + every - m->phase) % every + every;
+   serv_ins (m);
+   serv_unlock ();
+   return service_load ();
+}
+
+/*!
+ * \brief   Calculate the worst-case per-tick service load. This is the
+ * maximum number of services that may run in the same tick.
+ *
+ * \return  The worst-case number of services in one tick.
+ * \note
+ *    The result is an upper bound. It counts, for each service, the services
+ *    it meets at least once. It is exact when those services also meet each
+ *    other, as with harmonic periods.
+ */
+int service_load (void)
+{
+   service_item_t *m;
+   int n, max = 0;
+
+   serv_lock ();
+   for (m=servl.head ; m ; m=m->next)
+      if ((n = 1 + serv_conflicts (m->every, m->phase, m)) > max)
+         max = n;
+   serv_unlock ();
+   return max;
+}
+
+/*!
+ * \brief   Rescale the services after a tick frequency change, so they
+ * keep their real time period.
+ * \param   fo  The old tick frequency.
+ * \param   fn  The new tick frequency.
+ * \note    Call with the kernel ISRs masked.
+ * \note    The rescale is monotonic, so the list keeps its order and we
+ *          change the nodes in place. A process that walks the list under
+ *          the service lock never sees it relinked.
+ */
+void service_rescale (clock_t fo, clock_t fn)
+{
+   service_item_t *m;
+
+   for (m=servl.head ; m ; m=m->next) {
+      if (!(m->every = kticks_rescale (m->every, fo, fn)))
+         m->every = 1;
+      m->due = (ktime_passed (m->due)) ? Ticks : Ticks + kticks_rescale (m->due - Ticks, fo, fn);
+      m->phase = m->due % m->every;    // The phase the service runs on from now
+   }
+}
+
+/*!
+ * \brief   Return the ticks until the next service runs.
+ * \return  The ticks to the head's due tick, 0 if it is due, or
+ *          (clock_t)-1 if there are no services.
+ */
+clock_t service_next (void)
+{
+   service_item_t *m = servl.head;
+
+   if (!m)
+      return (clock_t)-1;
+   return (ktime_passed (m->due)) ? 0 : m->due - Ticks;
 }
 
 /*!
  * \brief   Remove a function from Service list
  * \param   fptr Pointer to function
+ * \note    A service may remove itself. services() has it out of the list
+ *          while it runs, so we find it in serv_cur.
  */
 void service_rem (service_t fptr)
 {
-   service_item_t *m = servl.head;
+   service_item_t *m;
 
+   serv_lock ();
    // Find node or return
-   for ( ; m && (m->fptr!=fptr) ; m=m->next)
+   for (m=servl.head ; m && (m->fptr!=fptr) ; m=m->next)
       ;
-   if (!m)
-      return;
-
-   // Remove it
-   kernel_vars.service_lock = 1;
-   /*
-    * Service lock for list manipulation.
-    * It's OK to loose "some" ticks when we configure services.
-    */
-   if(m->prev)
-      m->prev->next = m->next;
-   if(m->next)
-      m->next->prev = m->prev;
-   if(servl.head == m)
-      servl.head = m->next;
-   if(servl.tail == m)
-      servl.tail = m->prev;
-   kernel_vars.service_lock = 0;
-   free (m);
+   if (m)
+      serv_remove (m);
+   else if (serv_cur && serv_cur->fptr == fptr) {
+      m = serv_cur;
+      serv_cur = 0;     // Tell services() not to put it back
+   }
+   serv_unlock ();
+   if (m)
+      free (m);
 }
 
 /*!
  * \brief
- *    Micron service. This function is called from SysTick
- *    handler every tick.
+ *    Micron service. This function is called from the PendSV
+ *    handler, after every tick. \sa os_deferred()
+ *
+ *    The service list is ordered by due tick, so we only look at the
+ *    head. A tick that runs nothing costs one compare. The service is
+ *    out of the list while it runs, so it may remove itself.
  */
 void services (void)
 {
-   service_item_t *m = servl.head;
+   service_item_t *m;
 
-   if (!m || kernel_vars.service_lock)
+   if (!servl.head || kernel_vars.service_lock)
       return;     // Service lock, or no service list. Aboard!
 
-   // Find node to call
-   do {
-      if (!(Ticks % m->every))
-         m->fptr ();
-      m=m->next;
-   } while (m);
+   while ((m = servl.head) && ktime_passed (m->due)) {
+      KTRACE (KTR_SERVICE, 0, (uint32_t)m->fptr);
+      serv_remove (m);
+      serv_cur = m;
+      m->fptr ();
+      if (!serv_cur)
+         continue;      // It removed itself, service_rem() freed it
+      serv_cur = 0;
+      m->due += m->every;
+      if (ktime_passed (m->due))
+         // We lost ticks (service lock). Skip to the next period.
+         m->due += ((Ticks - m->due) / m->every + 1) * m->every;
+      serv_ins (m);
+   }
 }
 
+/* ================== cron expressions ================== */
+
+#define CRON_SEARCH_YEARS     (28)  /*!< The calendar repeats its weekdays every 28 years. */
+
 /*!
- * \brief   Adds a function to micron list
- * \param   pfun  Pointer to function
- * \param   every Tick period. Micron will run the \a fptr every \b every Ticks
+ * \brief   Convert days since 1-Jan-1970 to a civil date.
+ */
+static void cron_civil (long days, int *y, int *m, int *d)
+{
+   long era, doe, yoe, doy, mp;
+
+   days += 719468;
+   era = (days >= 0 ? days : days - 146096) / 146097;
+   doe = days - era * 146097;
+   yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+   doy = doe - (365*yoe + yoe/4 - yoe/100);
+   mp = (5*doy + 2) / 153;
+   *d = (int)(doy - (153*mp + 2)/5 + 1);
+   *m = (int)(mp < 10 ? mp + 3 : mp - 9);
+   *y = (int)(yoe + era * 400 + (*m <= 2));
+}
+
+/*!
+ * \brief   The number of days in month \a m of year \a y.
+ */
+static int cron_mdays (int y, int m)
+{
+   static const uint8_t md[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
+
+   if (m == 2 && !(y % 4) && ((y % 100) || !(y % 400)))
+      return 29;
+   return md[m-1];
+}
+
+/*!
+ * \brief   Return the first set bit of \a mask in [\a from, \a to], or -1.
+ */
+static int cron_bit (uint64_t mask, int from, int to)
+{
+   for ( ; from <= to ; ++from)
+      if (mask & ((uint64_t)1 << from))
+         return from;
+   return -1;
+}
+
+/*!
+ * \brief   Check the day fields of \a e. As in crontab(5), if both mday
+ * and wday are restricted, a day matches if either matches.
+ */
+static int cron_day (const cron_expr_t *e, int d, int wd)
+{
+   int md = (e->mday & ((uint32_t)1 << d)) ? 1 : 0;
+   int w  = (e->wday & (1 << wd)) ? 1 : 0;
+
+   if ((e->mday & 0xFFFFFFFE) != 0xFFFFFFFE && (e->wday & 0x7F) != 0x7F)
+      return md || w;
+   return md && w;
+}
+
+/*!
+ * \brief   Read a decimal number.
+ * \return  The number, or -1 if there is no digit at \a *s.
+ */
+static int cron_num (const char **s)
+{
+   int n = -1;
+
+   for ( ; **s >= '0' && **s <= '9' ; ++*s)
+      n = ((n < 0) ? 0 : n*10) + (**s - '0');
+   return n;
+}
+
+/*!
+ * \brief   Parse one field of a cron expression. A field is a comma
+ * separated list of "*", "n" or "a-b", each with an optional "/step".
  *
- * \note
- *    All the entries will run in privileged mode and will use the main
- *    stack.
+ * \param   s     The field
+ * \param   mask  Pointer to the mask to fill
+ * \param   lo    The minimum value of the field
+ * \param   hi    The maximum value of the field
+ * \return  Pointer after the field, or NULL on error.
  */
-void crontab ( process_ptr_t fptr, size_t ms,
-               int8_t nice, int8_t fit, uint8_t pr,
-               time_t at, time_t every)
+static const char *cron_field (const char *s, uint64_t *mask, int lo, int hi)
 {
-   cron_t *m = (cron_t *) malloc (sizeof (cron_t));
+   int a, b, st;
 
-   if (!m)  // check for free space
-      return;
+   while (*s == ' ' || *s == '\t')
+      ++s;
+   *mask = 0;
+   while (1) {
+      if (*s == '*') {
+         a = lo;
+         b = hi;
+         ++s;
+      }
+      else {
+         if ((a = b = cron_num (&s)) < 0)
+            return NULL;
+         if (*s == '-' && (++s, (b = cron_num (&s)) < 0))
+            return NULL;
+      }
+      st = 1;
+      if (*s == '/') {
+         ++s;
+         if ((st = cron_num (&s)) < 1)
+            return NULL;
+         if (a == b)
+            b = hi;     // "n/step" runs from n to the end
+      }
+      if (a < lo || b > hi || a > b)
+         return NULL;
+      for ( ; a <= b ; a += st)
+         *mask |= (uint64_t)1 << a;
+      if (*s != ',')
+         break;
+      ++s;     // An empty element, as in "5,", fails on the next pass
+   }
+   return (*s == 0 || *s == ' ' || *s == '\t') ? s : NULL;
+}
 
-   // Add the cron node to the cron list
-   kernel_vars.cron_stretch = 1;
-   /*
-    * Cron stretching for list manipulation.
-    * It's OK to loose "some" ticks when we configure cron.
-    */
-   if(!cronl.head)
-      cronl.head = m;
-   else
-      cronl.tail->next = m;
+/*!
+ * \brief   Parse a crontab(5) style expression "min hour mday month wday".
+ *
+ * Each field is a comma separated list of "*", "n" or "a-b", each with an
+ * optional "/step". For example "30 2 * * 1-5" is every weekday at 02:30
+ * and "*\/15 * * * *" is every quarter. In wday both 0 and 7 are Sunday.
+ *
+ * \param   e  Pointer to the expression to fill
+ * \param   s  The expression string
+ * \return  0 on success, -1 on a syntax or range error.
+ */
+int cron_parse (cron_expr_t *e, const char *s)
+{
+   uint64_t m[5];
 
-   m->next = 0;
-   m->prev = cronl.tail;
-   cronl.tail = m;
+   if (!e || !s)
+      return -1;
+   if (!(s = cron_field (s, &m[0], 0, 59))
+    || !(s = cron_field (s, &m[1], 0, 23))
+    || !(s = cron_field (s, &m[2], 1, 31))
+    || !(s = cron_field (s, &m[3], 1, 12))
+    || !(s = cron_field (s, &m[4], 0, 7)))
+      return -1;
+   while (*s == ' ' || *s == '\t')
+      ++s;
+   if (*s)
+      return -1;
+   e->minute = m[0];
+   e->hour = (uint32_t)m[1];
+   e->mday = (uint32_t)m[2];
+   e->month = (uint16_t)m[3];
+   e->wday = (uint8_t)((m[4] | (m[4] >> 7)) & 0x7F);
+   return 0;
+}
 
-   // Fill cron values
-   m->fptr = fptr;
-   m->ms = ms;
-   m->nice = nice;
-   m->fit = fit;
-   m->pr = pr;
-   m->at = at;
-   m->every = every;
-   kernel_vars.cron_stretch = 0;
+/*!
+ * \brief   Calculate the next fire time of a cron expression.
+ *
+ * The search is incremental. It skips whole months, days and hours that do
+ * not match, so it costs a few steps per field and not one per minute.
+ *
+ * \param   e  Pointer to the expression
+ * \param   t  The time to search after
+ * \return  The first matching time after \a t, or 0 if the expression never
+ *          matches (for example "0 0 30 2 *").
+ * \note    The fields are compared with the broken down \a t as UTC. If
+ *          time() counts local time, so does the expression.
+ */
+time_t cron_expr_next (const cron_expr_t *e, time_t t)
+{
+   long days, end;
+   int y, mo, d, h, mi, sec;
+
+   if (!e || t < 0)
+      return 0;
+   t += 60 - (t % 60);  // The next minute
+   days = (long)(t / 86400);
+   sec = (int)(t % 86400);
+   h = sec / 3600;
+   mi = (sec % 3600) / 60;
+   for (end = days + CRON_SEARCH_YEARS*366 ; days < end ; ) {
+      cron_civil (days, &y, &mo, &d);
+      if (!(e->month & (1 << mo))) {
+         // Skip to the first of the next month
+         days += cron_mdays (y, mo) - d + 1;
+         h = mi = 0;
+         continue;
+      }
+      if (!cron_day (e, d, (int)((days + 4) % 7))) {  // 1-Jan-1970 was Thursday
+         ++days;
+         h = mi = 0;
+         continue;
+      }
+      if ((sec = cron_bit (e->hour, h, 23)) < 0) {
+         ++days;
+         h = mi = 0;
+         continue;
+      }
+      if (sec != h) {
+         h = sec;
+         mi = 0;
+      }
+      if ((mi = cron_bit (e->minute, mi, 59)) < 0) {
+         if (++h > 23) {
+            ++days;
+            h = 0;
+         }
+         mi = 0;
+         continue;
+      }
+      return (time_t)days * 86400 + h * 3600 + mi * 60;
+   }
+   return 0;
 }
 
+/* ================== cron daemon ================== */
+
 /*!
- * \brief   Remove a function from Micron
- * \param   fptr Pointer to function
+ * \brief   Calculate the first fire time of a cron node, not before \a now.
+ * \param   m     Pointer to the cron node
+ * \param   now   The current time
+ * \return  The fire time, or 0 if a one-shot node has passed.
  */
-void crontab_r (process_ptr_t fptr)
+static time_t cron_next (cron_t *m, time_t now)
+{
+   if (m->cal)
+      return cron_expr_next (&m->expr, now - 1);
+   if (now <= m->at)
+      return m->at;
+   if (!m->every)
+      return 0;
+   return m->at + ((now - m->at + m->every - 1) / m->every) * m->every;
+}
+
+/*!
+ * \brief   Insert a cron node in the cron list, ordered by fire time.
+ * \param   m  Pointer to the cron node
+ */
+static void cron_ins (cron_t *m)
 {
-   cron_t *m = cronl.head;
+   cron_t *p;
 
-   // Find node or return
-   for ( ; m && (m->fptr!=fptr) ; m=m->next)
+   for (p=cronl.head ; p && p->next_t <= m->next_t ; p=p->next)
       ;
-   if (!m)
-      return;
+   m->next = p;
+   if (p) {
+      m->prev = p->prev;
+      p->prev = m;
+   }
+   else {
+      m->prev = cronl.tail;
+      cronl.tail = m;
+   }
+   if (m->prev)
+      m->prev->next = m;
+   else
+      cronl.head = m;
+}
 
-   // Remove it
-   kernel_vars.cron_stretch = 1;
-   /*
-    * Cron stretching for list manipulation.
-    * It's OK to loose "some" ticks when we configure cron.
-    */
+/*!
+ * \brief   Remove a cron node from the cron list.
+ * \param   m  Pointer to the cron node
+ */
+static void cron_remove (cron_t *m)
+{
    if(m->prev)
       m->prev->next = m->next;
    if(m->next)
@@ -188,56 +584,188 @@ void crontab_r (process_ptr_t fptr)
       cronl.head = m->next;
    if(cronl.tail == m)
       cronl.tail = m->prev;
-   kernel_vars.cron_stretch = 0;
-   free (m);
 }
 
 /*!
- * \brief
- *    Returns the cron_postponed flag
+ * \brief   The cron daemon. It spawns the due entries of the cron list and
+ * sleeps until the next fire time, or until crontab() changes the list.
+ * The list is ordered by fire time, so only the head is checked.
  */
-inline uint8_t cron_stretching(void) {
-   return kernel_vars.cron_stretch;
+static void cron_daemon (void)
+{
+   cron_t *m;
+   time_t now;
+   uint64_t t;
+   pid_t pid;
+
+   while (1) {
+      mut_lock (&cr.lock);
+      now = time (0);
+      while ((m = cronl.head) && m->next_t <= now) {
+         cron_remove (m);
+         // Call knew() if the process does not exist
+         if (proc_search_pid (m->fptr) == -1) {
+            if ((pid = knew (m->fptr, m->ms, m->nice, m->fit)) > 0)
+               KTRACE (KTR_CRON, pid, 0);
+         }
+         // Skip the periods we lost, if any.
+         if ((m->next_t = cron_next (m, now + 1)) != 0)
+            cron_ins (m);
+         else
+            free (m);   // one-shot, or no more fire times
+      }
+      t = 0;
+      if (cronl.head) {
+         /*
+          * Sleep up to the second tick of the next fire time, but at most
+          * CRON_SLEEP_MAX ticks. A far fire time just loops here again.
+          */
+         t = (uint64_t)(cronl.head->next_t - now - 1) * get_freq () + Now_left;
+         if (t > CRON_SLEEP_MAX)
+            t = CRON_SLEEP_MAX;
+      }
+      mut_unlock (&cr.lock);
+      notify_wait (CRON_NOTIFY, (clock_t)t);
+   }
 }
 
 /*!
- * \brief
- *    Cron service. This function is called from SysTick
- *    handler every sec.
+ * \brief   Init the kernel's cron.
+ * - Create the cron daemon process, if it does not exist.
+ *
+ * The first crontab() calls it with CRON_STACK_SIZE. Call it before
+ * to pick another stack size.
+ *
+ * \param   mem The size of the cron daemon's stack in bytes.
+ * \return  The pid of the cron daemon, or -1 on failure.
  */
-void cron (void)
+int kinit_cron (size_t mem)
 {
-   cron_t *m = cronl.head;
+   pid_t pid;
 
-   if (!m)     // No Cron list. Abort!
-      return;
+   mut_lock (&cr.lock);
+   if (!cr.daemon) {
+      if ((pid = knew (&cron_daemon, mem, 0, 0)) > 0)
+         cr.daemon = pid;
+   }
+   mut_unlock (&cr.lock);
+   return (cr.daemon) ? cr.daemon : -1;
+}
+
+/*!
+ * \brief   Add a filled cron node to the cron list and wake the daemon.
+ * The first node starts the daemon.
+ * \param   m  Pointer to the cron node
+ */
+static void cron_add (cron_t *m)
+{
+   mut_lock (&cr.lock);
+   cron_ins (m);
+   mut_unlock (&cr.lock);
+   if (cr.daemon)
+      notify (cr.daemon, CRON_NOTIFY, NOTIFY_SET_BITS);
+   else
+      kinit_cron (CRON_STACK_SIZE);
+}
 
-   if (__malloc_state() || __proc_state())
-   {
-      /*
-       * malloc or proc[] is locked.
-       * Aboart with cron stretching.
-       */
-       kernel_vars.cron_stretch = 1;
+/*!
+ * \brief   Adds a process to the cron list.
+ * \param   fptr  Pointer to process function
+ * \param   ms    The process stack size
+ * \param   nice  The process nice value
+ * \param   fit   The process fit flag
+ * \param   pr    The process privileged flag
+ * \param   at    The time to create the process first.
+ * \param   every The period in seconds, or 0 to create the process once.
+ *
+ * \note
+ *    The processes are created from the cron daemon. The first entry
+ *    starts it with CRON_STACK_SIZE, \sa kinit_cron().
+ *    If the process already exists, cron does not create it again.
+ */
+void crontab ( process_ptr_t fptr, size_t ms,
+               int8_t nice, int8_t fit, uint8_t pr,
+               time_t at, time_t every)
+{
+   cron_t *m = (cron_t *) malloc (sizeof (cron_t));
+
+   if (!m)  // check for free space
       return;
+
+   // Fill cron values
+   m->fptr = fptr;
+   m->ms = ms;
+   m->nice = nice;
+   m->fit = fit;
+   m->pr = pr;
+   m->at = at;
+   m->every = every;
+   m->cal = 0;
+   if (!(m->next_t = cron_next (m, time (0))))
+      m->next_t = time (0);   // a one-shot in the past runs now
+
+   cron_add (m);
+}
+
+/*!
+ * \brief   Adds a process to the cron list with a calendar schedule.
+ * \param   fptr  Pointer to process function
+ * \param   ms    The process stack size
+ * \param   nice  The process nice value
+ * \param   fit   The process fit flag
+ * \param   pr    The process privileged flag
+ * \param   e     The schedule. \sa cron_parse()
+ * \return  0 on success, -1 on failure or if \a e never matches.
+ *
+ * \note
+ *    The processes are created from the cron daemon. The first entry
+ *    starts it with CRON_STACK_SIZE, \sa kinit_cron().
+ *    If the process already exists, cron does not create it again.
+ */
+int crontab_expr ( process_ptr_t fptr, size_t ms,
+                   int8_t nice, int8_t fit, uint8_t pr,
+                   const cron_expr_t *e)
+{
+   cron_t *m;
+
+   if (!e || !(m = (cron_t *) malloc (sizeof (cron_t))))
+      return -1;
+
+   // Fill cron values
+   m->fptr = fptr;
+   m->ms = ms;
+   m->nice = nice;
+   m->fit = fit;
+   m->pr = pr;
+   m->at = m->every = 0;
+   m->cal = 1;
+   m->expr = *e;
+   if (!(m->next_t = cron_next (m, time (0)))) {
+      free (m);
+      return -1;
    }
-   // Find process to create
-   do {
-      time_t t = time(0);
-      if ((t == m->at) || (!((t - m->at) % m->every))) {
-         // Call knew() if the process does not exist
-         if (proc_search_pid (m->fptr) == -1)
-            knew (m->fptr, m->ms, m->nice, m->fit);
-         kernel_vars.cron_stretch = 0;
-         /*!
-          * \note
-          * Yes! We can call knew(). But only if no one else has locked
-          * malloc. We wait until malloc_unlock() (Cron stretching). Then we
-          * clear cron_strech flag So the SysTick ISR will not call cron() again.
-          *
-          * *** So yes we call knew() and we don't have reentrant struct! Faaaact! ***
-          */
-      }
-      m=m->next;
-   } while (m);
+   cron_add (m);
+   return 0;
+}
+
+/*!
+ * \brief   Remove a process from the cron list
+ * \param   fptr Pointer to process function
+ * \note    The daemon is notified, so it does not sleep to the removed
+ *          entry's time.
+ */
+void crontab_r (process_ptr_t fptr)
+{
+   cron_t *m;
+
+   mut_lock (&cr.lock);
+   // Find node or return
+   for (m = cronl.head ; m && (m->fptr!=fptr) ; m=m->next)
+      ;
+   if (m)
+      cron_remove (m);
+   mut_unlock (&cr.lock);
+   if (m && cr.daemon)
+      notify (cr.daemon, CRON_NOTIFY, NOTIFY_SET_BITS);
+   free (m);
 }
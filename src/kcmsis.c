@@ -23,6 +23,7 @@
  */
 
 #include <kcmsis.h>
+#include <string.h>
 
 /* ===============  Compiler specific Intrinsics  =============== */
 
@@ -96,6 +97,50 @@ uint8_t __kPrivilege(void)
    return (!r);
 }
 
+/*!
+ * \brief  Make a semihosting call to the debugger or the simulator.
+ * \param  op   The semihosting operation
+ * \param  arg  Pointer to the operation's argument block
+ * \return The debugger's result
+ * \warning Without a debugger attached the BKPT instruction faults.
+ */
+int __ksemihost (int op, void *arg)
+{
+   register int r0 __asm ("r0") = op;
+   register void *r1 __asm ("r1") = arg;
+
+   __asm volatile ("BKPT 0xAB \n\t" : "+r" (r0) : "r" (r1) : "memory");
+   return r0;
+}
+
+/*!
+ * \brief  Write a memory block to a new host file through semihosting.
+ * \param  file The host file name
+ * \param  buf  The block
+ * \param  size The block size in bytes
+ * \return 0 on success, -1 on error.
+ */
+int __ksemihost_dump (const char *file, const void *buf, uint32_t size)
+{
+   uint32_t a[3];
+   int fd, r;
+
+   if (!file)
+      return -1;
+   a[0] = (uint32_t)file;
+   a[1] = 5;                     // "wb"
+   a[2] = strlen (file);
+   if ((fd = __ksemihost (KSH_OPEN, a)) < 0)
+      return -1;
+   a[0] = (uint32_t)fd;
+   a[1] = (uint32_t)buf;
+   a[2] = size;
+   r = __ksemihost (KSH_WRITE, a);   // The bytes not written
+   a[0] = (uint32_t)fd;
+   __ksemihost (KSH_CLOSE, a);
+   return (r) ? -1 : 0;
+}
+
 /**
  * @brief  Return the Main Stack Pointer
  *
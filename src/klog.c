@@ -0,0 +1,65 @@
+/*
+ * klog.c : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+#include <klog.h>
+
+#ifdef PKERNEL_KLOG
+
+#if (PKERNEL_KLOG_SIZE & (PKERNEL_KLOG_SIZE-1))
+#error "PKERNEL_KLOG_SIZE must be a power of 2"
+#endif
+
+/*!
+ * The log ring buffer. Keep the symbol, the host tools look for it in
+ * memory dumps.
+ */
+klog_t klog_buf = {
+   KLOG_MAGIC, KLOG_VERSION, sizeof (uint32_t), PKERNEL_KLOG_SIZE, 0, 0, {0}
+};
+
+/*!
+ * \brief Write the log ring buffer to a host file through semihosting,
+ * for example under QEMU with -semihosting. The file is the klog_t as is.
+ * \sa tools/klog_decode.py
+ *
+ * \param file  The host file name
+ * \return 0 on success, -1 on error.
+ * \note The records written while we write may be torn. The decoder
+ * resynchronizes on the next valid format id.
+ */
+int klog_drain (const char *file)
+{
+   klog_buf.clk = get_clock ();
+   return __ksemihost_dump (file, &klog_buf, sizeof (klog_buf));
+}
+
+#else
+
+int klog_drain (const char *file)
+{
+   (void)file;
+   return -1;
+}
+
+#endif   //#ifdef PKERNEL_KLOG
@@ -0,0 +1,145 @@
+/*
+ * kprof.c : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+#include <kprof.h>
+#include <proc.h>
+#include <string.h>
+
+#ifdef PKERNEL_PROF
+
+#if (PKERNEL_PROF_SIZE & (PKERNEL_PROF_SIZE-1))
+#error "PKERNEL_PROF_SIZE must be a power of 2"
+#endif
+
+/*!
+ * The profiler histogram. Keep the symbol, the host tools look for it in
+ * memory dumps.
+ */
+kprof_t kprof_buf = {
+   KPROF_MAGIC, KPROF_VERSION, sizeof (kprof_ent_t), PKERNEL_PROF_SIZE, PKERNEL_PROF_SHIFT,
+   0, 0, 0, 0, 0, { {0} }
+};
+
+/*!
+ * \brief Take one sample. Called from the SysTick handler.
+ *
+ * When SysTick returns to thread mode (RETTOBASE) the interrupted process
+ * runs on the PSP and its pc is in the hardware stack frame on top of it.
+ * Otherwise SysTick preempted another handler and the sample only counts.
+ */
+void kprof_sample (void)
+{
+   hw_stack_frame_t *f;
+   kprof_ent_t *e;
+   uint32_t pc, h, i;
+   pid_t pid;
+
+   if (!kprof_buf.on)
+      return;
+   ++kprof_buf.samples;
+   if (!(kSCB->ICSR & kSCB_ICSR_RETTOBASE_Msk)
+         || (pid = proc_get_current_pid ()) < 0) {
+      ++kprof_buf.isr;
+      return;
+   }
+   f = (hw_stack_frame_t *)kget_PSP ();
+   pc = f->pc & ~((1UL<<PKERNEL_PROF_SHIFT)-1);
+
+   h = ((pc >> PKERNEL_PROF_SHIFT) ^ ((uint32_t)pid << 24)) * 0x9E3779B1;
+   h ^= h >> 16;
+   for (i=0 ; i<KPROF_PROBE ; ++i) {
+      e = &kprof_buf.ent[(h + i) & (PKERNEL_PROF_SIZE-1)];
+      if (!e->cnt) {
+         e->pc = pc;
+         e->pid = (uint16_t)pid;
+         e->cnt = 1;
+         return;
+      }
+      if (e->pc == pc && e->pid == (uint16_t)pid) {
+         if (e->cnt != 0xFFFF)
+            ++e->cnt;
+         return;
+      }
+   }
+   ++kprof_buf.lost;
+}
+
+/*!
+ * \brief Start sampling, on top of the samples already taken.
+ */
+void kprof_start (void)
+{
+   kprof_buf.hz = get_freq ();
+   kprof_buf.on = 1;
+}
+
+/*!
+ * \brief Stop sampling. The histogram stays for kprof_drain().
+ */
+void kprof_stop (void)
+{
+   kprof_buf.on = 0;
+}
+
+/*!
+ * \brief Clear the histogram. Sampling stays as it was.
+ */
+void kprof_clear (void)
+{
+   uint8_t on = kprof_buf.on;
+
+   kprof_buf.on = 0;
+   memset (kprof_buf.ent, 0, sizeof (kprof_buf.ent));
+   kprof_buf.samples = kprof_buf.isr = kprof_buf.lost = 0;
+   kprof_buf.on = on;
+}
+
+/*!
+ * \brief Write the histogram to a host file through semihosting, for
+ * example under QEMU with -semihosting. The file is the kprof_t as is.
+ * \sa tools/kprof.py
+ *
+ * \param file  The host file name
+ * \return 0 on success, -1 on error.
+ * \note Stop the profiler first, or a slot may be torn while we write.
+ */
+int kprof_drain (const char *file)
+{
+   kprof_buf.hz = get_freq ();
+   return __ksemihost_dump (file, &kprof_buf, sizeof (kprof_buf));
+}
+
+#else
+
+void kprof_start (void) { }
+void kprof_stop (void) { }
+void kprof_clear (void) { }
+
+int kprof_drain (const char *file)
+{
+   (void)file;
+   return -1;
+}
+
+#endif   //#ifdef PKERNEL_PROF
@@ -23,9 +23,41 @@
  */
 
 #include <ktime.h>
+#include <os.h>
 
 static clock_t  volatile kcpu_clk;     /*!< The kernel's "knowledge" of cpu clock */
 static clock_t  volatile kfreq;        /*!< The kernels frequency */
+static uint32_t volatile ktick_f;      /*!< The tick frequency since kbase_t */
+static uint64_t volatile kcyc_ns;      /*!< The cpu cycle period in nsec, 40.24 fixed point, so clocks below 4 MHz fit */
+static uint64_t volatile kbase_t;      /*!< The tick of the last rate change */
+static uint64_t volatile kbase_ns;     /*!< kclock_ns() at the tick kbase_t */
+static uint8_t  kdwt;                  /*!< Set if we have the DWT cycle counter */
+
+/*!
+ * RTC synchronization state. Now runs from SysTick and is compared with
+ * the external RTC every \a every secs. \sa ktime_sync()
+ */
+static struct
+{
+   time_t   every;      /*!< The resync interval in secs */
+   time_t   next;       /*!< The Now of the next resync, 0 for never synced */
+   time_t   sec;        /*!< The Now of the last slew step */
+   long     slew;       /*!< Ticks of drift left to correct, positive if we are late */
+   time_t   edge;       /*!< The RTC second we wait to change, while hunting its edge */
+   time_t   hunt;       /*!< The Now the edge hunt started, 0 when not hunting */
+}ksync = { KTIME_SYNC_EVERY, 0, 0, 0, 0, 0 };
+
+/*!
+ * Clock governor state. \sa ktime_governor()
+ */
+static struct
+{
+   kgov_ft        policy;     /*!< The user policy, NULL for no governor */
+   kclk_switch_ft sw;         /*!< The cpu clock switch */
+   clock_t        window;     /*!< The load measurement window in ticks */
+   clock_t        start;      /*!< The Ticks at the start of the window */
+   clock_t        idle;       /*!< The idle ticks at the start of the window */
+}kgov;
 
 ext_time_ft _ext_time = NULL;         //!< Pointer to External time callback function
 ext_settime_ft _ext_settime = NULL;   //!< Pointer to External set time callback function
@@ -35,6 +67,15 @@ ext_settime_ft _ext_settime = NULL;   //!< Pointer to External set time callback
  */
 void kinit_SysTick (void)
 {
+   Now_left = get_freq ();
+   // Start the DWT cycle counter, if the core has one
+   kCoreDebug_DEMCR |= kCoreDebug_DEMCR_TRCENA_Msk;
+   if (!(kDWT->CTRL & kDWT_CTRL_NOCYCCNT_Msk)) {
+      kDWT->CYCCNT = 0;
+      kDWT->CTRL |= kDWT_CTRL_CYCCNTENA_Msk;
+      kdwt = 1;
+   }
+
    // Time base configuration and enable
    kSysTick->LOAD = kcpu_clk / kfreq;
    kSysTick->VAL  = 0;
@@ -43,6 +84,88 @@ void kinit_SysTick (void)
                     kSysTick_CTRL_ENABLE_Msk;
 }
 
+static uint64_t kclock_read (uint32_t *cyc);
+
+/*!
+ * The monotonic nsec of tick \a t plus \a cyc cpu cycles. The ticks since
+ * the base are converted exactly, 1e9 / ktick_f does not have to be an
+ * integer. \a t is kbase_t - 1 in the partial tick of a rate change.
+ */
+static uint64_t kclock_at (uint64_t t, uint32_t cyc)
+{
+   uint64_t d, ns = kbase_ns;
+   uint32_t f = ktick_f;
+
+   if (!f)
+      ;        // Not configured yet
+   else if (t >= kbase_t) {
+      d = t - kbase_t;
+      ns += (d / f) * 1000000000UL + ((d % f) * 1000000000UL) / f;
+   }
+   else
+      ns -= ((kbase_t - t) * 1000000000UL) / f;
+   return ns + (((uint64_t)cyc * kcyc_ns) >> 24);
+}
+
+/*!
+ * Update the time conversion factors for kfreq and kcpu_clk
+ */
+static void kscale (void)
+{
+   if (kfreq)
+      ktick_f = kfreq;
+   if (kcpu_clk)
+      kcyc_ns = ((uint64_t)1000000000UL << 24) / kcpu_clk;
+}
+
+/*!
+ * Reprogram SysTick for \a clk and \a f and keep the phase of the tick in
+ * progress. The rest of the current tick is rescaled and loaded for one
+ * period, then the full period is loaded for the next reload.
+ *
+ * kclock_ns() keeps running: the time base moves to the end of the partial
+ * tick, with the new tick and cycle periods after it. The time the clock
+ * switch takes stays in the tick phase, as SysTick keeps counting while
+ * \a sw relocks the PLL.
+ *
+ * \param clk The new cpu clock.
+ * \param f   The new tick frequency.
+ * \param sw  The cpu clock switch, or NULL if the clock has already changed.
+ * \note Call with the kernel ISRs masked.
+ */
+static void ksystick_reload (clock_t clk, clock_t f, kclk_switch_ft sw)
+{
+   uint32_t load, val, cyc, rem, pm;
+   uint32_t nload = clk / f;
+   uint64_t t, ns, cns = ((uint64_t)1000000000UL << 24) / clk;
+
+   if (sw)
+      sw (clk);
+   if (!(kSysTick->CTRL & kSysTick_CTRL_ENABLE_Msk)) {
+      kSysTick->LOAD = nload;    // Not running yet, nothing to keep
+      return;
+   }
+   KTIME_IRQ_SAVE (pm);          // Readers above BASEPRI see the old or the new base
+   t = kclock_read (&cyc);
+   ns = kclock_at (t, cyc);
+   load = kSysTick->LOAD;
+   val = kSysTick->VAL;
+   rem = (uint32_t)(((uint64_t)val * (nload + 1)) / (load + 1));
+   if (rem < KTIME_RELOAD_MIN)
+      rem = KTIME_RELOAD_MIN;
+   kSysTick->LOAD = rem;
+   kSysTick->VAL = 0;            // Clears the counter, it reloads rem on the next clock
+   while (!kSysTick->VAL)
+      ;
+   kSysTick->LOAD = nload;
+   // The partial tick ends rem new cycles from now, at tick t+1
+   kbase_t = t + 1;
+   kbase_ns = ns + (((uint64_t)rem * cns) >> 24);
+   ktick_f = f;
+   kcyc_ns = cns;
+   KTIME_IRQ_RESTORE (pm);
+}
+
 /*!
  * \brief Get the pkernel's knowledge of os frequency.
  * \return OS Frequency
@@ -60,6 +183,7 @@ inline clock_t get_freq (void) {
  */
 inline void set_freq (clock_t f) {
    kfreq = f;
+   kscale ();
 }
 
 /*!
@@ -70,10 +194,23 @@ inline void set_freq (clock_t f) {
  */
 void update_freq (clock_t f)
 {
-   if (kfreq != f)
+   clock_t fo = kfreq;
+
+   if (f && fo != f)
    {
+      __os_halt_ISR();
+      ksystick_reload (kcpu_clk, f, NULL);
+      if (fo) {
+         // Pending alarms, services and timers keep their real time
+         sch_rescale (fo, f);
+         service_rescale (fo, f);
+         ktimer_rescale (fo, f);
+         if (!(Now_left = kticks_rescale (Now_left, fo, f)))
+            Now_left = 1;
+      }
       kfreq = f;
-      kSysTick->LOAD = kcpu_clk / kfreq;
+      kscale ();
+      __os_resume_ISR();
    }
 }
 
@@ -94,6 +231,7 @@ inline clock_t get_clock (void) {
  */
 inline void set_clock (clock_t clk) {
    kcpu_clk = clk;
+   kscale ();
 }
 
 /*!
@@ -105,10 +243,76 @@ inline void set_clock (clock_t clk) {
 void update_clock (clock_t clk)
 {
    if (kcpu_clk != clk)
-   {
-      kcpu_clk = clk;
-      kSysTick->LOAD = kcpu_clk / kfreq;
-   }
+      kclock_change (clk, NULL);
+}
+
+/*!
+ * \brief
+ *    Change the CPU clock without losing time. The tick frequency stays
+ *    the same, so Ticks and all the alarms keep their real time. The
+ *    SysTick is reprogrammed around the hardware switch and keeps the
+ *    phase of the tick in progress.
+ *
+ * \param clk The new CPU frequency.
+ * \param sw  The function that switches the clock hardware to \a clk. It is
+ *            called with the kernel ISRs masked. NULL if the clock has
+ *            already changed.
+ * \return 0 on success, -1 on error.
+ */
+int kclock_change (clock_t clk, kclk_switch_ft sw)
+{
+   if (!clk || !kfreq)
+      return -1;
+   __os_halt_ISR();
+   ksystick_reload (clk, kfreq, sw);
+   kcpu_clk = clk;
+   kscale ();
+   __os_resume_ISR();
+   return 0;
+}
+
+/*!
+ * \brief
+ *    Install a clock governor. Every \a window ticks pkernel measures the
+ *    load, the percent of ticks with a process in runq, and asks \a policy
+ *    for the CPU clock. If it returns a different clock, pkernel changes to
+ *    it with \sa kclock_change().
+ *
+ *    For example, a policy may return the low clock for loads under 30%
+ *    and the high clock for loads over 70%.
+ *
+ * \param policy The governor policy, or NULL to remove the governor.
+ * \param sw     The clock hardware switch. \sa kclock_change()
+ * \param window The measurement window in ticks.
+ */
+void kset_governor (kgov_ft policy, kclk_switch_ft sw, clock_t window)
+{
+   kgov.policy = NULL;
+   kgov.sw = sw;
+   kgov.window = (window) ? window : 1;
+   kgov.start = Ticks;
+   kgov.idle = kernel_vars.idle_ticks;
+   kgov.policy = policy;
+}
+
+/*!
+ * \brief
+ *    The clock governor. Called from the kernel's deferred tick work.
+ */
+void ktime_governor (void)
+{
+   clock_t n, idle, clk;
+   int load;
+
+   if (!kgov.policy || !ktime_passed (kgov.start + kgov.window))
+      return;
+   n = Ticks - kgov.start;
+   idle = kernel_vars.idle_ticks - kgov.idle;
+   load = (idle < n) ? (int)(100 - (idle * 100) / n) : 0;
+   kgov.start = Ticks;
+   kgov.idle = kernel_vars.idle_ticks;
+   if ((clk = kgov.policy (kcpu_clk, load)) != 0 && clk != kcpu_clk)
+      kclock_change (clk, kgov.sw);
 }
 
 /*
@@ -118,14 +322,19 @@ void update_clock (clock_t clk)
 /*!
  * \brief
  *    Set the External time() provider. This sets the \sa _ext_time
- *    This way the usys can call the _ext_time() to provide a more
- *    accurate time().
+ *    pkernel does not call it on every time(). It keeps Now running from
+ *    SysTick and resyncs it with the _ext_time() every few seconds.
+ *    \sa kset_rtc_sync()
  *
  * \param   f     Pointer to User's (or driver's) callback
  * \return        None
  */
 void kset_rtc_time (ext_time_ft f) {
-   if (f)   _ext_time = f;
+   if (f) {
+      _ext_time = f;
+      ksync.next = 0;   // Sync on the next tick
+      ksync.hunt = 0;
+   }
 }
 
 /*!
@@ -140,6 +349,85 @@ void kset_rtc_settime (ext_settime_ft f) {
    if (f)   _ext_settime = f;
 }
 
+/*!
+ * \brief
+ *    Set the RTC resync interval.
+ *
+ * \param   every The interval in secs. 0 sets the default KTIME_SYNC_EVERY.
+ * \return        None
+ */
+void kset_rtc_sync (time_t every) {
+   ksync.every = (every > 0) ? every : KTIME_SYNC_EVERY;
+}
+
+/*!
+ * \brief
+ *    Keep Now in sync with the external RTC. Called from the kernel's
+ *    deferred tick work.
+ *    - Every \a ksync.every secs hunt the RTC second edge. The RTC counts
+ *      whole seconds out of phase with Now, so a single read is off by up
+ *      to a second. We read it on each tick until it changes. At that
+ *      tick the RTC is at the start of its second, and the offset to Now
+ *      is known to a tick.
+ *    - Offsets of KTIME_STEP secs or more, and the first read, step Now
+ *      at once. Smaller offsets are slewed.
+ *    - Once per second, correct a part of the slew by making the current
+ *      second shorter or longer, up to 1/KTIME_SLEW_DIV of a second.
+ *      So Now never jumps and never runs backwards for small drifts.
+ */
+void ktime_sync (void)
+{
+   time_t rtc, now = Now;
+   long d, max, left;
+
+   if (!_ext_time)
+      return;
+   if (ksync.slew && now != ksync.sec) {
+      ksync.sec = now;
+      max = (long)(kfreq / KTIME_SLEW_DIV);
+      d = (ksync.slew > max) ? max : (ksync.slew < -max) ? -max : ksync.slew;
+      __os_halt_ISR();
+      if ((long)Now_left - d >= 1) {
+         Now_left -= d;
+         ksync.slew -= d;
+      }
+      __os_resume_ISR();
+   }
+   if (ksync.next && (long)(now - ksync.next) < 0)
+      return;
+
+   rtc = _ext_time (0);
+   if (ksync.next) {
+      if (!ksync.hunt) {
+         // Start the edge hunt
+         ksync.hunt = (now) ? now : 1;
+         ksync.edge = rtc;
+         return;
+      }
+      if (rtc == ksync.edge && (long)(now - ksync.hunt) < 2)
+         return;     // Not yet. A stuck RTC gives up after 2 secs.
+      ksync.hunt = 0;
+   }
+   __os_halt_ISR();
+   now = Now;
+   left = (long)Now_left;
+   d = (long)(rtc - now);
+   if (!ksync.next || d >= KTIME_STEP || d <= -KTIME_STEP) {
+      // Step, and start our second with the RTC's
+      Now = rtc;
+      Now_left = kfreq;
+      ksync.slew = 0;
+   }
+   else if (rtc != ksync.edge)
+      // We are one tick into the RTC second, we are (kfreq - left) into ours
+      ksync.slew = d * (long)kfreq - ((long)kfreq - left);
+   else
+      ksync.slew = 0;   // No edge, no reliable offset
+   __os_resume_ISR();
+   ksync.sec = Now;
+   ksync.next = Now + ksync.every;
+}
+
 /*!
  * \brief
  *  determines the processor time used.
@@ -154,6 +442,96 @@ inline clock_t clock (void)
    return (clock_t) Ticks;
 }
 
+/*!
+ * \brief
+ *  Return the 64-bit monotonic tick counter. This never wraps in
+ *  practice, unlike \sa clock().
+ * \note
+ *  Safe to call from processes and ISRs. If SysTick updates the counter
+ *  between the two reads, we read again. An ISR that preempts SysTick
+ *  can not see half a wrap. \sa ktime_tick()
+ */
+uint64_t clock64 (void)
+{
+   return ktime_read64 ();
+}
+
+/*!
+ * \brief
+ *  Read the tick counter together with the cycles passed inside the tick.
+ * \param cyc  Pointer to store the cycles inside the current tick.
+ * \return The 64-bit tick counter.
+ * \note
+ *  If SysTick has reloaded but its ISR has not run yet, because we run
+ *  with SysTick masked or in a higher priority ISR, we count the tick here.
+ */
+static uint64_t kclock_read (uint32_t *cyc)
+{
+   uint64_t t;
+   uint32_t v, load;
+
+   do {
+      t = clock64 ();
+      v = kSysTick->VAL;
+      load = kSysTick->LOAD;
+   } while (t != clock64 ());
+   if ((kSCB->ICSR & kSCB_ICSR_PENDSTSET_Msk) && v > load/2)
+      ++t;
+   *cyc = load - v;
+   return t;
+}
+
+/*!
+ * \brief
+ *  Return a free running cpu cycle counter. This is the DWT cycle counter
+ *  if the core has one, else it is made from Ticks and SysTick.
+ * \note
+ *  The counter wraps. Use differences of it.
+ */
+uint32_t kcycles (void)
+{
+   uint32_t cyc;
+   uint64_t t;
+
+   if (kdwt)
+      return kDWT->CYCCNT;
+   t = kclock_read (&cyc);
+   return (uint32_t)t * (kSysTick->LOAD + 1) + cyc;
+}
+
+/*!
+ * \brief
+ *  Return the monotonic time since boot in nsec. It combines the 64-bit
+ *  tick counter with the cycles passed in the current tick, so the
+ *  resolution is one cpu cycle.
+ */
+uint64_t kclock_ns (void)
+{
+   uint32_t cyc;
+   uint64_t t = kclock_read (&cyc);
+
+   return kclock_at (t, cyc);
+}
+
+/*!
+ * \brief
+ *  clock_gettime() like call. Fills \a ts with the monotonic time since
+ *  boot, with sub-microsecond resolution. \sa kclock_ns()
+ * \return
+ *  On success, zero is returned. On error, -1 is returned
+ */
+int kclock_gettime (struct timespec *ts)
+{
+   uint64_t ns;
+
+   if (!ts)
+      return -1;
+   ns = kclock_ns ();
+   ts->tv_sec = (time_t)(ns / 1000000000UL);
+   ts->tv_nsec = (long)(ns % 1000000000UL);
+   return 0;
+}
+
 /*!
  * \brief
  *  determines the current calendar time. The encoding of the value is
@@ -164,13 +542,10 @@ inline clock_t clock (void)
  *  is also assigned to the object it points to.
  */
 time_t time (time_t *timer) {
-
-    if (_ext_time)
-        return _ext_time (timer);    // Forward to external time system
-    else {                           // If no external system, use Now
-        if (timer)  *timer = (time_t)Now;
-        return (time_t)Now;
-    }
+    // Now runs from SysTick and, if we have an external time
+    // system, ktime_sync() keeps it close to it.
+    if (timer)  *timer = (time_t)Now;
+    return (time_t)Now;
 }
 
 /*!
@@ -184,14 +559,12 @@ time_t time (time_t *timer) {
  *    On success, zero is returned.  On error, -1 is returned
  */
 int settime (const time_t *t) {
+    if (!t)
+        return -1;
+    Now = *t;
+    ksync.slew = 0;
+    ksync.next = *t + ksync.every;
     if (_ext_settime)
         return _ext_settime (t);     // Forward to external time system
-    else {                           // If no external system, use __now
-        if (t) {
-            Now = *t;
-            return 0;
-        }
-        else
-            return -1;
-    }
+    return 0;
 }
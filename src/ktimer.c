@@ -0,0 +1,335 @@
+/*
+ * ktimer.c : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+#include <os.h>
+
+/*!
+ * The hierarchical timer wheel.
+ *
+ * Level 0 has one slot per tick. Each slot of level n covers KTW_SIZE
+ * slots of level n-1. Each tick moves the due level 0 slot to the expired
+ * list and, every KTW_SIZE ticks, cascades one slot of the upper levels
+ * one level down. The timer daemon runs the call-backs of the expired
+ * list in process context.
+ */
+static struct
+{
+   klist_t  slot[KTW_LEVELS][KTW_SIZE];
+   klist_t  expired;    /*!< Timers due, waiting for the daemon. */
+   clock_t  now;        /*!< The last tick processed by ktimer_tick(). */
+   pid_t    daemon;     /*!< The timer daemon's pid, 0 before kinit_timers(). */
+}tw;
+
+/* ================== list operations ================== */
+
+static inline void kl_init (klist_t *l) {
+   l->next = l->prev = l;
+}
+
+static inline int kl_empty (klist_t *l) {
+   return (!l->next || l->next == l) ? 1 : 0;
+}
+
+static inline void kl_ins_back (klist_t *l, klist_t *n) {
+   n->prev = l->prev;
+   n->next = l;
+   l->prev->next = n;
+   l->prev = n;
+}
+
+static inline void kl_remove (klist_t *n) {
+   n->prev->next = n->next;
+   n->next->prev = n->prev;
+   kl_init (n);
+}
+
+/*!
+ * \brief Move all the nodes of \a from at the end of \a to.
+ */
+static inline void kl_splice (klist_t *from, klist_t *to) {
+   from->next->prev = to->prev;
+   to->prev->next = from->next;
+   from->prev->next = to;
+   to->prev = from->prev;
+   kl_init (from);
+}
+
+/* ================== wheel operations ================== */
+
+/*!
+ * \brief Put the timer in the wheel slot for the tick \a at.
+ * \param t   The timer.
+ * \param at  The tick the timer must reach level 0. Must not be before tw.now.
+ * \note Call with the kernel ISRs masked.
+ */
+static void ktw_place (ktimer_t *t, clock_t at)
+{
+   clock_t delta = at - tw.now;
+   int l;
+
+   for (l=0 ; l<KTW_LEVELS-1 ; ++l)
+      if (delta < ((clock_t)1 << (KTW_BITS*(l+1))))
+         break;
+   if (l == KTW_LEVELS-1 && delta >= ((clock_t)1 << (KTW_BITS*KTW_LEVELS)))
+      at = tw.now + ((clock_t)1 << (KTW_BITS*KTW_LEVELS)) - 1;   // Out of range, wait in the last slot
+
+   kl_ins_back (&tw.slot[l][(at >> (KTW_BITS*l)) & KTW_MASK], &t->node);
+}
+
+/*!
+ * \brief Re-place all the timers of an upper level slot.
+ */
+static void ktw_cascade (klist_t *slot)
+{
+   ktimer_t *t;
+
+   while (!kl_empty (slot)) {
+      t = (ktimer_t*)slot->next;
+      kl_remove (&t->node);
+      ktw_place (t, (ktime_before (t->expire, tw.now)) ? tw.now : t->expire);
+   }
+}
+
+/*!
+ * \brief Arm the timer, relative to the processed tick.
+ * \note Call with the kernel ISRs masked.
+ */
+static void ktw_arm (ktimer_t *t)
+{
+   // The current tick is already processed. Never place a timer there.
+   ktw_place (t, (ktime_before (tw.now, t->expire)) ? t->expire : tw.now + 1);
+}
+
+/*!
+ * \brief The timer daemon. It waits for the tick to notify it and runs the
+ * call-backs of the expired timers. Periodic timers are armed again before
+ * the call-back, relative to their previous expire tick, so they do not drift.
+ */
+static void ktimer_daemon (void)
+{
+   ktimer_t *t;
+
+   while (1) {
+      notify_wait (KTIMER_NOTIFY, 0);
+      while (1) {
+         __os_halt_ISR();
+         if (kl_empty (&tw.expired)) {
+            __os_resume_ISR();
+            break;
+         }
+         t = (ktimer_t*)tw.expired.next;
+         kl_remove (&t->node);
+         if (t->period) {
+            t->expire += t->period;
+            ktw_arm (t);
+         }
+         __os_resume_ISR();
+         t->fptr (t->arg);
+      }
+   }
+}
+
+/* ================== Exported Functions ================== */
+
+/*!
+ * \brief Init the kernel's software timers.
+ * - Init the timer wheel
+ * - Create the timer daemon process.
+ *
+ * \param mem The size of the timer daemon's stack in bytes. All the
+ * timer call-backs run on it.
+ * \return The pid of the timer daemon, or -1 on failure.
+ */
+int kinit_timers (size_t mem)
+{
+   int l, i;
+
+   for (l=0 ; l<KTW_LEVELS ; ++l)
+      for (i=0 ; i<KTW_SIZE ; ++i)
+         kl_init (&tw.slot[l][i]);
+   kl_init (&tw.expired);
+   tw.now = Ticks;
+   tw.daemon = knew (&ktimer_daemon, mem, -10, 0);
+   if (tw.daemon <= 0)
+      tw.daemon = 0;
+   return (tw.daemon) ? tw.daemon : -1;
+}
+
+/*!
+ * \brief Advance the timer wheel up to tick \a now. Called from the
+ * kernel's deferred tick work, \sa os_deferred(). Each tick since the
+ * last call is processed in order:
+ * - Every KTW_SIZE ticks cascade the upper level slots.
+ * - Move the due level 0 slot in the expired list and notify the daemon.
+ *
+ * \param now The last tick to process.
+ * \note A tick without due timers costs one compare.
+ */
+void ktimer_tick (clock_t now)
+{
+   klist_t *s;
+   clock_t t;
+   int l;
+
+   if (!tw.daemon) {
+      tw.now = now;
+      return;
+   }
+   while (tw.now != now) {
+      t = ++tw.now;
+      for (l=1 ; l<KTW_LEVELS && !((t >> (KTW_BITS*(l-1))) & KTW_MASK) ; ++l)
+         ktw_cascade (&tw.slot[l][(t >> (KTW_BITS*l)) & KTW_MASK]);
+
+      s = &tw.slot[0][t & KTW_MASK];
+      if (!kl_empty (s)) {
+         kl_splice (s, &tw.expired);
+         notify (tw.daemon, KTIMER_NOTIFY, NOTIFY_SET_BITS);
+      }
+   }
+}
+
+/*!
+ * \brief Rescale the armed timers after a tick frequency change, so they
+ * keep their real time expire and period.
+ *
+ * \param fo  The old tick frequency.
+ * \param fn  The new tick frequency.
+ * \note Call with the kernel ISRs masked.
+ */
+void ktimer_rescale (clock_t fo, clock_t fn)
+{
+   klist_t all;
+   ktimer_t *t;
+   int l, i;
+
+   if (!tw.daemon)
+      return;
+   kl_init (&all);
+   for (l=0 ; l<KTW_LEVELS ; ++l)
+      for (i=0 ; i<KTW_SIZE ; ++i)
+         if (!kl_empty (&tw.slot[l][i]))
+            kl_splice (&tw.slot[l][i], &all);
+   while (!kl_empty (&all)) {
+      t = (ktimer_t*)all.next;
+      kl_remove (&t->node);
+      if (ktime_before (tw.now, t->expire))
+         t->expire = tw.now + kticks_rescale (t->expire - tw.now, fo, fn);
+      if (t->period && !(t->period = kticks_rescale (t->period, fo, fn)))
+         t->period = 1;
+      ktw_arm (t);
+   }
+}
+
+/*!
+ * \brief Return the ticks until the timer wheel may expire a timer. For
+ * the upper levels this is the next cascade of a non empty slot, so the
+ * result is a lower bound.
+ *
+ * \return The ticks to the next expire, 0 if call-backs are pending, or
+ * (clock_t)-1 if there are no armed timers.
+ * \note Call with the kernel ISRs masked.
+ */
+clock_t ktimer_next (void)
+{
+   clock_t d, b, min = (clock_t)-1;
+   int l, k;
+
+   if (!tw.daemon)
+      return min;
+   if (!kl_empty (&tw.expired))
+      return 0;
+   for (l=0 ; l<KTW_LEVELS ; ++l)
+      for (k=1 ; k<=KTW_SIZE ; ++k) {
+         b = (tw.now >> (KTW_BITS*l)) + k;
+         if (!kl_empty (&tw.slot[l][b & KTW_MASK])) {
+            d = (b << (KTW_BITS*l)) - tw.now;
+            if (d < min)
+               min = d;
+            break;
+         }
+      }
+   // Ticks may be ahead of the processed tick
+   d = Ticks - tw.now;
+   return (min == (clock_t)-1) ? min : (min > d) ? min - d : 0;
+}
+
+/*!
+ * \brief Initialize a software timer. The timer is not armed.
+ *
+ * \param t     Pointer to the timer.
+ * \param fptr  The call-back function. It runs in the timer daemon.
+ * \param arg   The call-back argument.
+ */
+void ktimer_init (ktimer_t *t, ktimer_cb_t fptr, void *arg)
+{
+   kl_init (&t->node);
+   t->fptr = fptr;
+   t->arg = arg;
+   t->expire = t->period = 0;
+}
+
+/*!
+ * \brief Arm (or re-arm) a software timer. O(1).
+ *
+ * \param t      Pointer to the timer.
+ * \param ticks  The ticks from now until the first call-back. 0 means the next tick.
+ * \param period The reload period in ticks, or 0 for one shot timer.
+ * \return 0 on success, -1 if the timers are not initialized. \sa kinit_timers()
+ */
+int ktimer_start (ktimer_t *t, clock_t ticks, clock_t period)
+{
+   if (!tw.daemon)
+      return -1;
+   __os_halt_ISR();
+   if (!kl_empty (&t->node))
+      kl_remove (&t->node);
+   t->expire = tw.now + ticks;
+   t->period = period;
+   ktw_arm (t);
+   __os_resume_ISR();
+   return 0;
+}
+
+/*!
+ * \brief Disarm a software timer. If the timer has expired but its
+ * call-back has not run yet, it will not run. O(1).
+ *
+ * \param t      Pointer to the timer.
+ */
+void ktimer_stop (ktimer_t *t)
+{
+   __os_halt_ISR();
+   if (!kl_empty (&t->node))
+      kl_remove (&t->node);
+   __os_resume_ISR();
+}
+
+/*!
+ * \brief Return true if the timer is armed, or expired and waiting
+ * for its call-back.
+ */
+int ktimer_active (ktimer_t *t)
+{
+   return !kl_empty (&t->node);
+}
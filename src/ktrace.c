@@ -0,0 +1,65 @@
+/*
+ * ktrace.c : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+#include <ktrace.h>
+
+#ifdef PKERNEL_TRACE
+
+#if (PKERNEL_TRACE_SIZE & (PKERNEL_TRACE_SIZE-1))
+#error "PKERNEL_TRACE_SIZE must be a power of 2"
+#endif
+
+/*!
+ * The trace ring buffer. Keep the symbol, the host tools look for it in
+ * memory dumps.
+ */
+ktrace_t ktrace_buf = {
+   KTRACE_MAGIC, KTRACE_VERSION, sizeof (ktrace_ev_t), PKERNEL_TRACE_SIZE, 0, 0, { {0} }
+};
+
+/*!
+ * \brief Write the trace ring buffer to a host file through semihosting,
+ * for example under QEMU with -semihosting. The file is the ktrace_t
+ * header followed by the ring. \sa tools/ktrace_decode.py
+ *
+ * \param file  The host file name
+ * \return 0 on success, -1 on error.
+ * \note The events recorded while we write may be torn. Drain when the
+ * system is quiet, or read the dropped events as noise.
+ */
+int ktrace_drain (const char *file)
+{
+   ktrace_buf.clk = get_clock ();
+   return __ksemihost_dump (file, &ktrace_buf, sizeof (ktrace_buf));
+}
+
+#else
+
+int ktrace_drain (const char *file)
+{
+   (void)file;
+   return -1;
+}
+
+#endif   //#ifdef PKERNEL_TRACE
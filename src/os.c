@@ -23,47 +23,133 @@
  */
 
 #include <os.h>
+#include <string.h>
 
-clock_t  volatile Ticks = 0;           /* cpu time */
+clock_t  volatile Ticks = TICKS_INIT;  /* cpu time */
+clock_t  volatile Ticks_hi = 0;        /* cpu time wraps */
 time_t   volatile Now = 0;             /* time in unix secs past 1-Jan-70 */
-time_t   volatile pNow = 0;
+clock_t  volatile Now_left = 0;        /* Ticks left until Now advances */
 
 static os_command_t os_command;
 
+#ifdef PKERNEL_TICKSTAT
+static uint32_t os_tick_max;           /* The worst-case SysTick ISR in cpu cycles */
+static uint32_t os_defer_max;          /* The worst-case deferred tick work in cpu cycles */
+#endif
+
+#ifdef PKERNEL_IRQLAT
+static kirqlat_t   os_irqlat;          /* The masked sections statistics */
+static uint32_t    os_irq_t0;          /* kcycles() at the mask */
+static const char  *os_irq_file;       /* The call site of the open section */
+static uint32_t    os_irq_line;
+static uint8_t     os_irq_on;          /* A masked section is open */
+#endif
+
+/*!
+ * \brief Try to take the first ready object of a kpoll() set.
+ *
+ * \param items  The kpoll() items.
+ * \param n      The number of items.
+ * \return The index of the item taken, or -1 if none is ready.
+ */
+static int kpoll_take (kpoll_t *items, int n)
+{
+   process_t *p;
+   int i;
+
+   for (i=0 ; i<n ; ++i)
+      switch (items[i].type)
+      {
+         case POLL_SEM:
+            if (sem_check ((sem_t*)items[i].obj))
+               return i;
+            break;
+         case POLL_MUT:
+            if (mut_trylock ((sem_t*)items[i].obj))
+               return i;
+            break;
+         case POLL_NOTIFY:
+            p = proc_get_current_proc ();
+            if ((items[i].got = katomic_fetch_and (&p->notify, ~items[i].mask) & items[i].mask) != 0)
+               return i;
+            break;
+         case POLL_TOPIC:
+            if (sub_available ((sub_t*)items[i].obj))
+               return i;
+            break;
+         default:
+            break;
+      }
+   return -1;
+}
+
+/*!
+ * \brief The kernel's deferred tick work. It runs from PendSV, at the
+ * lowest priority, so no peripheral ISR waits for it.
+ * - Keep Now in sync with the external RTC, if any
+ * - Run the clock governor, if any
+ * - Run the due services
+ * - Advance the timer wheel
+ *
+ * Both catch up by themselves if more than one tick passed since the last
+ * call, so it does not matter how many SysTicks pended it.
+ */
+static void os_deferred (void)
+{
+#ifdef PKERNEL_TICKSTAT
+   uint32_t c = kcycles ();
+#endif
+   ktime_sync ();
+   ktime_governor ();
+   services ();
+   ktimer_tick (Ticks);
+#ifdef PKERNEL_TICKSTAT
+   if ((c = kcycles () - c) > os_defer_max)
+      os_defer_max = c;
+#endif
+}
+
 /*=============  Interrupt Service Routines  ====================*/
 
 /*!
  * \brief This ISR handles SysTick. We update Ticks and Now.
  * We also consume time from the active process and trigger PendSV.
+ * All the other tick work is deferred to PendSV. \sa os_deferred()
  *
  * \param  None
  * \retval None
  */
 void SysTick_Handler(void) {
+#ifdef PKERNEL_TICKSTAT
+    uint32_t c = kcycles ();
+#endif
     /*
-    * Update Exported Counters and
-    * call cron and micron.
+    * Update Exported Counters
     */
-    ++Ticks;
-    if ( !_ext_time && !(Ticks % get_freq ()))
-        ++Now;   // Do not update Now when we have external time system
+    ktime_tick ();
+    if (Now_left > 1)
+        --Now_left;
+    else {
+        Now_left = get_freq ();
+        ++Now;
+    }
 
     if (kernel_vars.enable) {
-        // Trigger PendSV
-        __pendsv_trig ();
-        services ();
-        if (pNow != time(0)) {
-            pNow = time(0);
-            cron ();
-        }
-        // In case of cron stretching call cron() continuously.
-        if (cron_stretching())
-            cron ();
-
         // If we have process in runq consume time of it.
         if ( !sch_runq_empty () )
             proc_dec_ticks (proc_get_current_pid());
+        else
+            ++kernel_vars.idle_ticks;
+#ifdef PKERNEL_PROF
+        kprof_sample ();
+#endif
+        // Trigger PendSV
+        __pendsv_trig ();
     }
+#ifdef PKERNEL_TICKSTAT
+    if ((c = kcycles () - c) > os_tick_max)
+        os_tick_max = c;
+#endif
 }
 
 /*!
@@ -96,6 +182,8 @@ void PendSV_Handler (void)
 
    if (os_command.flags)         // Clear wait flags
       os_command.flags = 0;
+   if (kernel_vars.enable)
+      os_deferred ();
    /*
     * Get from scheduler the pid to run and check
     * if we have to change stack.
@@ -114,6 +202,131 @@ void PendSV_Handler (void)
                    "BX lr               \n\t" );
 }
 
+/*!
+ * \brief Return the worst-case SysTick ISR duration.
+ *
+ * SysTick does a fixed amount of work, whatever the services and the
+ * timers. The work it did before it was moved to PendSV is measured by
+ * kdeferred_wcet(). So with PKERNEL_TICKSTAT, ktick_wcet() is the ISR
+ * time after the move, and ktick_wcet() + kdeferred_wcet() bounds the
+ * time before it, on the same load.
+ *
+ * \param clear If true, restart the measurement.
+ * \return The duration in cpu cycles, or 0 if pkernel is built without
+ * PKERNEL_TICKSTAT.
+ */
+uint32_t ktick_wcet (int clear)
+{
+#ifdef PKERNEL_TICKSTAT
+   uint32_t r = os_tick_max;
+
+   if (clear)
+      os_tick_max = 0;
+   return r;
+#else
+   (void)clear;
+   return 0;
+#endif
+}
+
+/*!
+ * \brief Return the worst-case duration of the deferred tick work in
+ * PendSV, the services, the timer wheel and the time keeping.
+ *
+ * To measure the service dispatch, build with PKERNEL_TICKSTAT on a core
+ * with a DWT cycle counter. Add 1, 8 or 32 services with the same period
+ * and phase, so they all run in the same tick. Call kdeferred_wcet(1),
+ * let a few periods pass, then read kdeferred_wcet(0). An idle tick is
+ * the same run without a due service.
+ *
+ * \param clear If true, restart the measurement.
+ * \return The duration in cpu cycles, or 0 if pkernel is built without
+ * PKERNEL_TICKSTAT.
+ */
+uint32_t kdeferred_wcet (int clear)
+{
+#ifdef PKERNEL_TICKSTAT
+   uint32_t r = os_defer_max;
+
+   if (clear)
+      os_defer_max = 0;
+   return r;
+#else
+   (void)clear;
+   return 0;
+#endif
+}
+
+#ifdef PKERNEL_IRQLAT
+/*!
+ * \brief Open a masked section. Called with the interrupts masked.
+ * \param file   The call site
+ * \param line   The call site
+ * \note A section opened again before its exit restarts. So a masked
+ * section that an ISR above SysTick interrupts with its own is lost.
+ */
+void kirqlat_enter (const char *file, uint32_t line)
+{
+   os_irq_file = file;
+   os_irq_line = line;
+   os_irq_on = 1;
+   os_irq_t0 = kcycles ();
+}
+
+/*!
+ * \brief Close the masked section and account it. Called with the
+ * interrupts still masked.
+ */
+void kirqlat_exit (void)
+{
+   uint32_t d = kcycles () - os_irq_t0;
+   int b;
+
+   if (!os_irq_on)
+      return;
+   os_irq_on = 0;
+   ++os_irqlat.count;
+   os_irqlat.total += d;
+   if (d > os_irqlat.max) {
+      os_irqlat.max = d;
+      os_irqlat.file = os_irq_file;
+      os_irqlat.line = os_irq_line;
+   }
+   b = (d) ? 31 - __builtin_clz (d) : 0;
+   ++os_irqlat.hist[(b < KIRQLAT_BINS) ? b : KIRQLAT_BINS-1];
+}
+#endif
+
+/*!
+ * \brief Read the interrupt masked sections statistics.
+ *
+ * The sections are the __os_halt_ISR() - __os_resume_ISR() pairs and the
+ * PRIMASK sections of the low power modes after the wake-up. The worst
+ * case interrupt latency for the interrupts at or below SysTick priority
+ * is the longest section plus the hardware latency.
+ *
+ * \param st     Pointer to the statistics to fill
+ * \param clear  If true, restart the measurement.
+ * \note The durations come from kcycles(). Without a DWT cycle counter a
+ * section longer than a tick reads short.
+ * \note Without PKERNEL_IRQLAT the statistics are zero.
+ */
+void kirqlat_get (kirqlat_t *st, int clear)
+{
+#ifdef PKERNEL_IRQLAT
+   __os_mask_ISR();
+   if (st)
+      *st = os_irqlat;
+   if (clear)
+      memset (&os_irqlat, 0, sizeof (os_irqlat));
+   __os_unmask_ISR();
+#else
+   (void)clear;
+   if (st)
+      memset (st, 0, sizeof (*st));
+#endif
+}
+
 /*!
  * \brief Provide a functionality based on the os_command_enum_t
  * from pkernel.
@@ -133,6 +346,7 @@ void OS_Call (process_t *p, os_command_enum_t cmd)
     */
    while ( __pendsv_act() || __systick_act() )
       ;
+   KTRACE (KTR_CALL, p->id, cmd);
    __os_halt_ISR();
    switch (cmd)
    {
@@ -186,18 +400,46 @@ void exit (int status)
  * returns when the process resumes / wakes up.
  *
  * \param alarm The number of ticks in 1/CLOCKS_PER_SEC before
- * the process wakes up.
+ * the process wakes up. Must be less than half the clock_t range.
  * \note Thread safe, not reentrant.
  */
 void sleep (clock_t alarm)
 {
    process_t *p = proc_get_current_proc ();
 
-   p->alarm = Ticks + alarm;
+   p->alarm = ktime_alarm (alarm);
    OS_Call (p, OS_SUSPEND);
 }
 
 
+/*!
+ * \brief Suspend the process for \a us microseconds. The whole ticks are
+ * slept in the scheduler, the sub-tick remainder is a busy wait on the
+ * cpu cycle counter. \sa kcycles()
+ *
+ * \param us The number of microseconds.
+ * \note Thread safe, not reentrant.
+ */
+void usleep (uint32_t us)
+{
+   uint64_t now = kclock_ns ();
+   uint64_t end = now + (uint64_t)us * 1000;
+   clock_t t = (clock_t)(((uint64_t)us * get_freq ()) / 1000000UL);   // Whole ticks in us
+   uint32_t c, cyc;
+
+   /*
+    * We are inside a tick, so sleeping t ticks wakes before end.
+    * The interval is relative, it never overflows with the uptime.
+    */
+   if (t)
+      sleep (t);
+   if ((now = kclock_ns ()) >= end)
+      return;
+   cyc = (uint32_t)(((end - now) * get_clock ()) / 1000000000UL);
+   for (c = kcycles () ; kcycles () - c < cyc ; )
+      ;
+}
+
 /*!
  * \brief This function waits for a semaphore. If the semaphore
  *  is positive decreases it, if 0 then suspends the process.
@@ -209,13 +451,16 @@ void sleep (clock_t alarm)
 void sem_wait (sem_t *s) {
    process_t *p;
 
-   if (s->val <= 0) {
+   while (!sem_check (s)) {
        p = proc_get_current_proc ();
        p->sem = s;
        OS_Call (p, OS_SUSPEND);
+       /*
+        * \note
+        * Another process or ISR may take the semaphore between the
+        * wake up and the check. In that case we suspend again.
+        */
    }
-   // here s->val is always positive
-   --s->val;
 }
 
 /*!
@@ -223,7 +468,7 @@ void sem_wait (sem_t *s) {
  * the OS to awake the process.
  */
 void sem_post (sem_t *s) {
-   ++s->val;
+   katomic_fetch_add (&s->val, 1);
    /*
     * \Note we leave next tick's scheduler to awake the related process.
     */
@@ -237,6 +482,20 @@ void sem_post (sem_t *s) {
  * \note Thread safe, not reentrant.
  */
 inline void mut_lock (sem_t *m) {
+#ifdef PKERNEL_LOCKSTAT
+   uint64_t t;
+
+   if (m->stat) {
+      if (sem_check (m))
+         klock_account (m->stat, 0, 0);
+      else {
+         t = kclock_ns ();
+         sem_wait (m);
+         klock_account (m->stat, 1, kclock_ns () - t);
+      }
+      return;
+   }
+#endif
    sem_wait (m);
 }
 
@@ -246,8 +505,226 @@ inline void mut_lock (sem_t *m) {
  * the OS to awake the process.
 */
 void mut_unlock (sem_t *m) {
-    m->val =1;
+    katomic_xchg (&m->val, 1);
    /*
     * \Note we leave next tick's scheduler to awake the related process.
     */
 }
+
+/*!
+ * \brief  This function releases the mutex \a m and suspends the process
+ * until the condition \a c is signaled. On wake up the mutex is locked
+ * again before the function returns.
+ *
+ * \param  c pointer to condition variable used
+ * \param  m pointer to the mutex protecting the shared state
+ * \return None
+ * \note Thread safe, not reentrant.
+ */
+void cond_wait (cond_t *c, sem_t *m) {
+   process_t *p = proc_get_current_proc ();
+
+   katomic_fetch_add (&c->waiters, 1);
+   /*
+    * We count ourself before releasing the mutex, so a signal
+    * between the unlock and the suspend stays pending and is not lost.
+    */
+   p->wait = WAIT_COND;
+   p->wobj = (void*)c;
+   mut_unlock (m);
+   OS_Call (p, OS_SUSPEND);
+   mut_lock (m);
+}
+
+/*!
+ * \brief Wake up one of the processes waiting for the condition \a c,
+ * but leave the OS to awake the process.
+ */
+void cond_signal (cond_t *c) {
+   int s = c->signals;
+
+   while (s < c->waiters)
+      if (katomic_cas (&c->signals, &s, s+1))
+         break;
+   /*
+    * \Note the scheduler awakes the waiter with the higher priority.
+    */
+}
+
+/*!
+ * \brief Wake up all the processes waiting for the condition \a c,
+ * but leave the OS to awake the processes.
+ */
+void cond_broadcast (cond_t *c) {
+   katomic_xchg (&c->signals, c->waiters);
+   /*
+    * \Note the scheduler awakes the waiters in priority order.
+    */
+}
+
+/*!
+ * \brief  This function locks a reader-writer lock for reading. If there
+ * is no writer the lock is taken without entering the kernel, else the
+ * process suspends until the writers leave.
+ *
+ * \param  l pointer to reader-writer lock used
+ * \return None
+ * \note Thread safe, not reentrant.
+ */
+void rw_rdlock (rwlock_t *l) {
+   process_t *p;
+
+   if (rw_tryrdlock (l))
+      return;
+   p = proc_get_current_proc ();
+   p->wait = WAIT_RDLOCK;
+   p->wobj = (void*)l;
+   OS_Call (p, OS_SUSPEND);
+   // here the scheduler has already counted us as reader
+}
+
+/*!
+ * \brief  This function locks a reader-writer lock for writing. If the
+ * lock is free it is taken without entering the kernel, else the process
+ * suspends. A waiting writer blocks any new reader.
+ *
+ * \param  l pointer to reader-writer lock used
+ * \return None
+ * \note Thread safe, not reentrant.
+ */
+void rw_wrlock (rwlock_t *l) {
+   process_t *p;
+   int w = 0;
+
+   if (katomic_cas (&l->writer, &w, 1)) {
+      if (!l->readers)
+         return;
+      // We own the lock. Wait for the readers already in to leave.
+      p = proc_get_current_proc ();
+      p->wait = WAIT_WRDRAIN;
+   }
+   else {
+      katomic_fetch_add (&l->wwait, 1);
+      p = proc_get_current_proc ();
+      p->wait = WAIT_WRLOCK;
+   }
+   p->wobj = (void*)l;
+   OS_Call (p, OS_SUSPEND);
+   // here the lock is ours
+}
+
+/*!
+ * \brief Update the notification value of the process \a pid. If the
+ * process waits for any of the updated bits, it is marked for the
+ * scheduler, which moves it straight to runq without scanning the susq.
+ *
+ * \param pid    The target process.
+ * \param bits   The bits to apply to the notification value.
+ * \param action How to apply the bits. \sa notify_action_en
+ * \return 0 on success, -1 if there is no such process.
+ * \note Safe to call from ISRs.
+ */
+int notify (pid_t pid, uint32_t bits, notify_action_en action)
+{
+   process_t *p;
+
+   if (pid < 0 || pid >= MAX_PROC || !(p = proc_get_process (pid)) || !p->is)
+      return -1;
+
+   switch (action)
+   {
+      default:
+      case NOTIFY_SET_BITS:   katomic_fetch_or (&p->notify, bits);               break;
+      case NOTIFY_INCREMENT:  katomic_fetch_add ((volatile int*)&p->notify, 1);  break;
+      case NOTIFY_OVERWRITE:  p->notify = bits;                                  break;
+   }
+   if (p->wait == WAIT_NOTIFY && (p->notify & p->nmask))
+   {
+      katomic_fetch_or (&kernel_vars.notified, (uint32_t)0x1 << pid);
+      __pendsv_trig ();
+   }
+   return 0;
+}
+
+/*!
+ * \brief Wait for any of the bits in \a mask to be set in the notification
+ * value of the calling process. The returned bits are cleared.
+ *
+ * \param mask     The notification bits to wait for.
+ * \param timeout  The number of ticks to wait, or 0 to wait forever.
+ * \return The bits of \a mask that was set, or 0 on timeout.
+ * \note Thread safe, not reentrant.
+ */
+uint32_t notify_wait (uint32_t mask, clock_t timeout)
+{
+   process_t *p = proc_get_current_proc ();
+
+   if (!(p->notify & mask))
+   {
+      p->nmask = mask;
+      p->alarm = (timeout) ? ktime_alarm (timeout) : 0;
+      p->wait = WAIT_NOTIFY;
+      OS_Call (p, OS_SUSPEND);
+   }
+   return katomic_fetch_and (&p->notify, ~mask) & mask;
+}
+
+/*!
+ * \brief This function reads the next message of a subscriber. If there
+ * is none, suspends the process until the publisher publishes one.
+ *
+ * \param s       Pointer to subscriber used
+ * \param msg     Pointer to buffer for the message
+ * \param timeout The number of ticks to wait, or 0 to wait forever.
+ * \return true if a message was read, false on timeout.
+ * \note Thread safe, not reentrant.
+ */
+int sub_read (sub_t *s, void *msg, clock_t timeout)
+{
+   process_t *p;
+
+   if (sub_tryread (s, msg))
+      return 1;
+   p = proc_get_current_proc ();
+   p->alarm = (timeout) ? ktime_alarm (timeout) : 0;
+   p->wait = WAIT_TOPIC;
+   p->wobj = (void*)s;
+   OS_Call (p, OS_SUSPEND);
+   return sub_tryread (s, msg);
+}
+
+/*!
+ * \brief This function waits for any of the kernel objects in \a items.
+ * If none is ready, suspends the process until one of them becomes ready
+ * or the timeout expires. The ready object is taken as by the related
+ * non blocking call. \sa poll_en
+ *
+ * \param items   The objects to wait for.
+ * \param n       The number of items.
+ * \param timeout The number of ticks to wait, or 0 to wait forever.
+ * \return The index of the ready item, or -1 on timeout.
+ * \note Thread safe, not reentrant.
+ */
+int kpoll (kpoll_t *items, int n, clock_t timeout)
+{
+   process_t *p = proc_get_current_proc ();
+   kpollset_t set = { items, n };
+   clock_t alarm = ktime_alarm (timeout);
+   int r;
+
+   while ((r = kpoll_take (items, n)) < 0)
+   {
+      if (timeout && ktime_passed (alarm))
+         return -1;
+      p->alarm = (timeout) ? alarm : 0;
+      p->wait = WAIT_POLL;
+      p->wobj = (void*)&set;
+      OS_Call (p, OS_SUSPEND);
+      /*
+       * \note
+       * We may find the object taken by another process after the
+       * wake up. In that case we suspend again for the rest of the time.
+       */
+   }
+   return r;
+}
@@ -23,9 +23,47 @@
  */
 
 #include <pmcs.h>
+#include <os.h>
+#include <string.h>
 
 static callbacks_t callbacks;
 
+/*!
+ * Power management state.
+ * - The idle governor's mode latencies. Sleep mode has no cost by default.
+ *   Stop mode is used only after its latency is registered, as it needs
+ *   the application to set up a wake-up source. \sa set_pm_latency()
+ * - The residency and wake-up accounting, and the current model.
+ */
+static struct
+{
+   pm_lat_t    lat[IDLE_MODES];
+   pm_stats_t  stats;
+   uint64_t    time_ns[PM_MODES];   /*!< Residency in nsec */
+   uint32_t    ua[PM_MODES];        /*!< The current model in uA */
+   uint64_t    since;               /*!< kclock_ns() at the start of the statistics */
+}pms = { .lat = { {0, 0, 1}, {0, 0, 1}, {0, 0, 0} } };
+
+/*!
+ * \brief   Account a stay in a low power mode.
+ * \param   m     The mode.
+ * \param   t0    kclock_ns() at the entry.
+ * \param   wake  Set to attribute the wake-up. Call with PRIMASK set, so
+ *                the waking interrupt is still pending.
+ */
+static void pm_account (pm_mode_en m, uint64_t t0, int wake)
+{
+   uint32_t v;
+
+   pms.time_ns[m] += kclock_ns () - t0;
+   ++pms.stats.res[m].entries;
+   if (wake) {
+      v = (kSCB->ICSR & kSCB_ICSR_VECTPENDING_Msk) >> kSCB_ICSR_VECTPENDING_Pos;
+      pms.stats.last_wake = (uint16_t)v;
+      ++pms.stats.wake[(v < PM_WAKE_SRC) ? v : PM_WAKE_SRC-1];
+   }
+}
+
 /*!
  * \brief
  *    API function to put the CPU to sleep. When called from a privilege
@@ -33,6 +71,9 @@ static callbacks_t callbacks;
  *
  *    This function will called from pkernel, at idle if the kernel variable
  *    \sa idle_mode is set to \arg IDLE_SLEEP. \sa kernel_var_t
+ * \note
+ *    The interrupts are masked around WFI, so the waking interrupt runs
+ *    after the accounting and after postsleep().
  *
  * \param none.
  * \return none.
@@ -40,29 +81,27 @@ static callbacks_t callbacks;
 void sleepmode (void)
 {
    uint32_t fm, pm;   // faultmask and primask
+   uint64_t t;
 
    if (callbacks.presleep)     // Call-back
       callbacks.presleep();
-   if (callbacks.postsleep)// && __kPrivilege())
-   {
-      /*
-       * If postsleep call-back exist we must configure interrupts
-       * to execute after postsleep().
-       * Only for privilege mode.
-       */
-      fm = __kget_FAULTMASK (); // read mask state
-      pm = __kget_PRIMASK ();
-      __kset_FAULTMASK (0);     // keep NMI
-      __kset_PRIMASK (1);       // disable configurable priority exceptions
-   }
+   /*
+    * Configure interrupts to execute after the wake-up
+    * accounting and postsleep().
+    */
+   fm = __kget_FAULTMASK (); // read mask state
+   pm = __kget_PRIMASK ();
+   __kset_FAULTMASK (0);     // keep NMI
+   __kset_PRIMASK (1);       // disable configurable priority exceptions
+   t = kclock_ns ();
    __kWFI();
-   if (callbacks.postsleep)// && __kPrivilege())
-   {
-      // Run call-back if any and release PRIMASK, FAULTMASK
+   KIRQLAT_ENTER();          // The waking interrupt waits from here
+   pm_account (PM_SLEEP, t, 1);
+   if (callbacks.postsleep)   // Run call-back if any
       callbacks.postsleep ();
-      __kset_FAULTMASK (fm);    // restate exception masks
-      __kset_PRIMASK (pm);
-   }
+   KIRQLAT_EXIT();
+   __kset_FAULTMASK (fm);    // restate exception masks
+   __kset_PRIMASK (pm);
 }
 
 /*!
@@ -73,6 +112,9 @@ void sleepmode (void)
  *    \sa idle_mode is set to \arg IDLE_STOP. \sa kernel_var_t
  * \note
  *    This function will work only when called in privilege mode.
+ * \note
+ *    The stop residency is measured with the kernel time base. If SysTick
+ *    stops in stop mode, poststop() should advance the time base.
  *
  * \param none.
  * \return none.
@@ -80,35 +122,35 @@ void sleepmode (void)
 void stopmode (void)
 {
    uint32_t fm, pm;   // faultmask and primask
+   uint64_t t;
 
 //   if (! __kPrivilege())      // No privilege, Aboard!
 //      return;
    if (callbacks.prestop)     // Call-back
       callbacks.prestop();
-   if (callbacks.poststop)
-   {
-      /*
-       * If poststop call-back exist we must configure interrupts
-       * to execute after poststop().
-       */
-       fm = __kget_FAULTMASK (); // read mask state
-       pm = __kget_PRIMASK ();
-       __kset_FAULTMASK (0);     // keep NMI
-       __kset_PRIMASK (1);       // disable configurable priority exceptions
-   }
+   /*
+    * Configure interrupts to execute after the wake-up
+    * accounting and poststop().
+    */
+   fm = __kget_FAULTMASK (); // read mask state
+   pm = __kget_PRIMASK ();
+   __kset_FAULTMASK (0);     // keep NMI
+   __kset_PRIMASK (1);       // disable configurable priority exceptions
+
    // Set SLEEPDEEP flag and go to sleep
+   t = kclock_ns ();
    kSCB->SCR |= kSCB_SCR_SLEEPDEEP_Msk;
    __kWFI();
 
    // Hey, I'm awake, clear SLEEPDEEP flag
    kSCB->SCR &= ~kSCB_SCR_SLEEPDEEP_Msk;
-   if (callbacks.poststop)
-   {
-      // Run call-back if any and release PRIMASK, FAULTMASK
+   KIRQLAT_ENTER();          // The waking interrupt waits from here
+   pm_account (PM_STOP, t, 1);
+   if (callbacks.poststop)    // Run call-back if any
       callbacks.poststop ();
-      __kset_FAULTMASK (fm);    // restate exception masks
-      __kset_PRIMASK (pm);
-   }
+   KIRQLAT_EXIT();
+   __kset_FAULTMASK (fm);    // restate exception masks
+   __kset_PRIMASK (pm);
 }
 
 /*!
@@ -124,21 +166,27 @@ void stopmode (void)
  * \note
  *    To return from service mode call \see applicationmode() from within
  *    a service.
+ * \note
+ *    The service mode residency includes the time of the services.
  *
  * \param none.
  * \return none.
  */
 void servicemode (void)
 {
+   uint64_t t;
+
 //   if (! __kPrivilege())      // No privilege, Aboard!
 //      return;
    if (callbacks.presleep)    // Call-back
       callbacks.presleep();
 
    // Set SLEEPONEXIT flag and go to sleep
+   t = kclock_ns ();
    kSCB->SCR |= kSCB_SCR_SLEEPONEXIT_Msk;
    __kWFI();
 
+   pm_account (PM_SERVICE, t, 0);
    if (callbacks.postsleep)   // Call-back
       callbacks.postsleep ();
 }
@@ -238,4 +286,155 @@ void set_poststop (callback_t fptr)
    callbacks.poststop = fptr;
 }
 
+/*!
+ * \brief
+ *    Register the cost of an idle mode for the idle governor. The
+ *    governor uses a mode only if the time to the next kernel event
+ *    covers its entry and exit latency. \sa pm_auto()
+ *
+ * \param mode      IDLE_SLEEP or IDLE_STOP.
+ * \param entry_us  The time to enter the mode, including the call-backs.
+ * \param exit_us   The time to wake up, including the call-backs.
+ * \return none.
+ */
+void set_pm_latency (idle_mode_en mode, uint32_t entry_us, uint32_t exit_us)
+{
+   if (mode == IDLE_RUN || mode >= IDLE_MODES)
+      return;
+   pms.lat[mode].valid = 0;
+   pms.lat[mode].entry_us = entry_us;
+   pms.lat[mode].exit_us = exit_us;
+   pms.lat[mode].valid = 1;
+}
+
+/*!
+ * \brief
+ *    Return the ticks until the next kernel event. This is the earliest
+ *    of the process alarms (sleeps, timeouts, cron), the services and the
+ *    software timers. The prestop() call-back may use it to program the
+ *    wake-up source.
+ *
+ * \return The ticks to the next event, or (clock_t)-1 if there is none.
+ */
+clock_t pm_slack (void)
+{
+   clock_t s, t;
+
+   __os_halt_ISR();
+   s = sch_next_alarm ();
+   if ((t = service_next ()) < s)
+      s = t;
+   if ((t = ktimer_next ()) < s)
+      s = t;
+   __os_resume_ISR();
+   return s;
+}
+
+/*!
+ * \brief
+ *    The idle governor. Called from pkernel, at idle if the kernel variable
+ *    \sa idle_mode is set to \arg IDLE_AUTO. It picks the deepest mode whose
+ *    entry and exit latency fit before the next kernel event.
+ *    \sa pm_slack(), set_pm_latency()
+ *
+ * \param none.
+ * \return none.
+ */
+void pm_auto (void)
+{
+   clock_t s = pm_slack ();
+   uint64_t us;
+   int m;
+
+   us = (s == (clock_t)-1) ? (uint64_t)-1 : ((uint64_t)s * 1000000UL) / get_freq ();
+   for (m=IDLE_MODES-1 ; m>IDLE_RUN ; --m)
+      if (pms.lat[m].valid && us >= (uint64_t)pms.lat[m].entry_us + pms.lat[m].exit_us)
+         break;
+   ++pms.stats.chosen[m];
+   switch (m)
+   {
+      default:
+      case IDLE_RUN:
+         break;
+      case IDLE_SLEEP:
+         sleepmode();
+         break;
+      case IDLE_STOP:
+         stopmode();
+         break;
+   }
+}
+
+/*!
+ * \brief
+ *    Set the current model of a power mode. pkernel estimates the charge
+ *    of each mode as its residency times its current.
+ *
+ * \param mode  The power mode.
+ * \param ua    The mean current in the mode in uA.
+ * \return none.
+ */
+void set_pm_current (pm_mode_en mode, uint32_t ua)
+{
+   if (mode < PM_MODES)
+      pms.ua[mode] = ua;
+}
+
+/*!
+ * \brief
+ *    Read the power management statistics. That is the idle governor's
+ *    choices, the residency and the entries of each mode, the wake-up
+ *    sources and the estimated charge. The run residency is the time
+ *    since the start of the statistics, not spent in any other mode.
+ *
+ * \param st  Pointer to the statistics to fill.
+ * \return none.
+ * \note The idle path updates the 64-bit counters, so we copy them with
+ *    the kernel ISRs masked.
+ */
+void pm_get_stats (pm_stats_t *st)
+{
+   uint64_t total, low = 0, ns;
+   uint64_t time_ns[PM_MODES];
+   int m;
+
+   if (!st)
+      return;
+   __os_mask_ISR();
+   total = kclock_ns () - pms.since;
+   *st = pms.stats;
+   memcpy (time_ns, pms.time_ns, sizeof (time_ns));
+   __os_unmask_ISR();
+   st->charge_nc = 0;
+   for (m=PM_MODES-1 ; m>=PM_RUN ; --m) {
+      if (m == PM_RUN)
+         ns = (total > low) ? total - low : 0;
+      else
+         low += (ns = time_ns[m]);
+      st->res[m].time_us = ns / 1000;
+      st->res[m].charge_nc = (ns / 1000) * pms.ua[m] / 1000;   // uA * us = pC, fits for years of run time
+      st->charge_nc += st->res[m].charge_nc;
+   }
+   st->res[PM_RUN].entries = 0;
+}
+
+/*!
+ * \brief
+ *    Clear the power management statistics and start them again.
+ *
+ * \param none.
+ * \return none.
+ */
+void pm_clear_stats (void)
+{
+   int m;
+
+   __os_mask_ISR();
+   pms.since = kclock_ns ();
+   for (m=0 ; m<PM_MODES ; ++m)
+      pms.time_ns[m] = 0;
+   memset (&pms.stats, 0, sizeof (pms.stats));
+   __os_unmask_ISR();
+}
+
 
@@ -23,12 +23,19 @@
  */
 
 #include <proc.h>
+#include <os.h>
 
 /*!
  * Hold the processes. pkernel creates a process in the first available slot in proc[].
  * The @runq and @susq are pointing to this array. \sa runq, susq
  */
 static process_t proc[MAX_PROC];
+static uint32_t  proc_ts;     /*!< kcycles() at the last runtime accounting */
+#ifdef PKERNEL_LOCKSTAT
+klockstat_t __proc_lockstat = {       /*!< prock contention, heads the registered locks */
+   .name = "__proc_lock", .next = &__malloc_lockstat
+};
+#endif
 
 //static pid_t cur_pid;   /*!< pid of the currently executing process. The idle process's cur_pid is 0.*/
 //static pid_t last_pid;  /*!< pid of the last real process that was running, this should never become 0. */
@@ -41,9 +48,23 @@ static process_t proc[MAX_PROC];
  */
 void __proc_lock (void)
 {
-   while (kernel_vars.prock == 1)
-      ;
-   kernel_vars.prock = 1;
+   int l;
+#ifdef PKERNEL_LOCKSTAT
+   uint64_t t;
+
+   l = 0;
+   if (katomic_cas (&kernel_vars.prock, &l, 1)) {
+      klock_account (&__proc_lockstat, 0, 0);
+      return;
+   }
+   t = kclock_ns ();
+#endif
+   do
+      l = 0;
+   while (!katomic_cas (&kernel_vars.prock, &l, 1));
+#ifdef PKERNEL_LOCKSTAT
+   klock_account (&__proc_lockstat, 1, kclock_ns () - t);
+#endif
 }
 
 /*!
@@ -52,7 +73,7 @@ void __proc_lock (void)
  * \return None
  */
 inline void __proc_unlock (void){
-    kernel_vars.prock = 0;
+    katomic_xchg (&kernel_vars.prock, 0);
 }
 
 /*!
@@ -178,8 +199,14 @@ void proc_store_stack_pointer (uint32_t sp)
    process_t *cp;
 
    cp = proc_get_current_proc ();
-   if (cp)
+   if (cp) {
       cp->tcb.sp = sp;
+#ifdef PKERNEL_STACKCHECK
+      // The saved SP must be inside the stack and the last word untouched.
+      if (sp < cp->tcb.sp_tip || *(uint32_t*)cp->tcb.sp_tip != KSTACK_PAINT)
+         kstack_overflow (cp->id);
+#endif
+   }
 }
 
 /*!
@@ -262,13 +289,165 @@ void proc_dec_ticks (pid_t pid)
    p->time_slice--;
 }
 
+/*!
+ * \brief Charge the cpu cycles since the last call to the current process
+ * and count the switch to \a pid, if any. Called from the scheduler on
+ * every PendSV, so the cycle counter can not wrap between two calls.
+ *
+ * \param pid The process to run next.
+ */
+void proc_account (pid_t pid)
+{
+   process_t *o = proc_get_current_proc ();
+   uint32_t now = kcycles ();
+
+   if (o)
+      o->runtime += now - proc_ts;
+   proc_ts = now;
+   if (pid == kernel_vars.cur_pid)
+      return;
+   ++proc[pid].nsw;
+   if (!o || o->id == IDLE_PROC_ID)
+      ;  // idle just gives way
+   else if (o->susp || !o->is)
+      ++o->nvcsw;
+   else
+      ++o->nivcsw;
+}
+
+/*!
+ * \brief A top like snapshot of the processes' cpu usage.
+ *
+ * \param st    Array to fill, one item per existing process, idle included.
+ * \param n     The size of \a st.
+ * \param idle  Pointer to store the idle share since the last call, in
+ *              0.1%. May be NULL.
+ * \return The number of items filled.
+ * \note The shares are since the last ktop() call, the counters since the
+ * process creation.
+ */
+int ktop (kproc_stat_t *st, int n, uint16_t *idle)
+{
+   uint64_t d[MAX_PROC], total = 0;
+   int i, k = 0;
+
+   __os_halt_ISR();
+   proc_account (kernel_vars.cur_pid);
+   for (i=0 ; i<MAX_PROC ; ++i) {
+      d[i] = (proc[i].is) ? proc[i].runtime - proc[i].rt_snap : 0;
+      proc[i].rt_snap = proc[i].runtime;
+      total += d[i];
+   }
+   if (!total)
+      total = 1;
+   for (i=0 ; i<MAX_PROC ; ++i) {
+      if (!proc[i].is)
+         continue;
+      if (i == IDLE_PROC_ID && idle)
+         *idle = (uint16_t)((d[i] * 1000) / total);
+      if (st && k < n) {
+         st[k].pid = proc[i].id;
+         st[k].fptr = proc[i].fptr;
+         st[k].runtime = proc[i].runtime;
+         st[k].share = (uint16_t)((d[i] * 1000) / total);
+         st[k].nsw = proc[i].nsw;
+         st[k].nvcsw = proc[i].nvcsw;
+         st[k].nivcsw = proc[i].nivcsw;
+         ++k;
+      }
+   }
+   __os_resume_ISR();
+   return k;
+}
+
+/*!
+ * \brief Called when the stack check finds a stack overflow. The default
+ * halts the system. The application may override it.
+ *
+ * \param pid The process that overflowed its stack.
+ */
+__attribute__((weak)) void kstack_overflow (pid_t pid)
+{
+   (void)pid;
+   __os_halt_ISR();
+   while (1)
+      ;
+}
+
+/*!
+ * \brief Scan a few stack words for the stack high water marks. Called
+ * from the idle process on each loop, so it never stalls the system.
+ *
+ * Each round checks one process, from sp_tip upwards, until the first
+ * used word or the lowest one found so far. The painted words between
+ * sp_tip and that word were never used.
+ */
+void proc_stack_scan (void)
+{
+   static pid_t pid = 0;
+   process_t *p = proc + pid;
+   uint32_t *tip = (uint32_t*)p->tcb.sp_tip;
+   int k;
+
+   if (p->is && tip)
+      for (k=0 ; k<KSTACK_SCAN_WORDS ; ++k, ++p->tcb.scan)
+         if (p->tcb.scan >= p->tcb.free || tip[p->tcb.scan] != KSTACK_PAINT)
+            break;
+   if (!p->is || !tip || k < KSTACK_SCAN_WORDS) {
+      // End of round, go to the next process
+      if (p->is && p->tcb.scan < p->tcb.free)
+         p->tcb.free = p->tcb.scan;
+      p->tcb.scan = 0;
+      pid = (pid + 1) % MAX_PROC;
+   }
+}
+
+/*!
+ * \brief Report the stack use of the processes.
+ *
+ * \param st       Array to fill, one item per existing process, idle included.
+ * \param n        The size of \a st.
+ * \param reclaim  Pointer to store the total bytes that could be reclaimed,
+ *                 keeping a KSTACK_MARGIN % margin over each high water
+ *                 mark. May be NULL.
+ * \return The number of items filled.
+ * \note The high water marks come from the idle scan, so they lag while the
+ * system is busy.
+ */
+int kstack_stats (kstack_stat_t *st, int n, uint32_t *reclaim)
+{
+   uint32_t used, keep, r, total = 0;
+   int i, k = 0;
+
+   for (i=0 ; i<MAX_PROC ; ++i) {
+      if (!proc[i].is)
+         continue;
+      used = proc[i].tcb.size - proc[i].tcb.free * sizeof (uint32_t);
+      keep = used + (used * KSTACK_MARGIN) / 100;
+      r = (proc[i].tcb.size > keep) ? (proc[i].tcb.size - keep) & ~(sizeof (uint32_t) - 1) : 0;
+      total += r;
+      if (st && k < n) {
+         st[k].pid = proc[i].id;
+         st[k].fptr = proc[i].fptr;
+         st[k].size = proc[i].tcb.size;
+         st[k].used = used;
+         st[k].reclaim = r;
+         ++k;
+      }
+   }
+   if (reclaim)
+      *reclaim = total;
+   return k;
+}
+
 /*!
  * \brief The idle process. This process is forced from pkernel
  * if there is no other process in runq.
  */
 void proc_idle (void)
 {
-   while (1)
+   while (1) {
+      proc_stack_scan ();
       switch (kernel_vars.idle_mode)
       {
          default:
@@ -280,7 +459,11 @@ void proc_idle (void)
          case IDLE_STOP:
             stopmode();
             break;
+         case IDLE_AUTO:
+            pm_auto();
+            break;
       }
+   }
 }
 
 /*!
@@ -303,6 +486,7 @@ pid_t proc_newproc (process_ptr_t fptr, size_t mem, int8_t nice, int8_t fit)
    int8_t i;
    pid_t pid = -1;
    uint32_t* pm = NULL;
+   size_t w;
    hw_stack_frame_t *pfrm;
 
    /* Find an empty slot in proc table */
@@ -326,8 +510,16 @@ pid_t proc_newproc (process_ptr_t fptr, size_t mem, int8_t nice, int8_t fit)
    else
       pid = i;
 
+   /* paint the stack, to measure the use later */
+   mem &= ~(sizeof (uint32_t) - 1);
+   for (w=0 ; w<mem/sizeof (uint32_t) ; ++w)
+      pm[w] = KSTACK_PAINT;
+
    /* prepare the process before put it into runq */
    proc[pid].tcb.sp_tip = (uint32_t) pm;
+   proc[pid].tcb.size = mem;
+   proc[pid].tcb.free = mem/sizeof (uint32_t);
+   proc[pid].tcb.scan = 0;
    proc[pid].id = pid;
    proc[pid].fptr = fptr;
    proc[pid].is = 1;
@@ -335,6 +527,13 @@ pid_t proc_newproc (process_ptr_t fptr, size_t mem, int8_t nice, int8_t fit)
    proc[pid].fit = fit;
    proc[pid].alarm = 0;
    proc[pid].sem = (void*) 0;
+   proc[pid].wait = WAIT_NONE;
+   proc[pid].wobj = (void*) 0;
+   proc[pid].susp = 0;
+   proc[pid].notify = 0;
+   proc[pid].nmask = 0;
+   proc[pid].runtime = proc[pid].rt_snap = 0;
+   proc[pid].nsw = proc[pid].nvcsw = proc[pid].nivcsw = 0;
    proc_rst_ticks (pid);
 
    pfrm = (hw_stack_frame_t *) (proc[pid].tcb.sp_tip + mem - sizeof(hw_stack_frame_t));
@@ -23,6 +23,8 @@
  */
 
 #include <sched.h>
+#include <topic.h>
+#include <ktrace.h>
 
 /*!
  * A list that holds all the active/running processes. The list does not
@@ -36,9 +38,82 @@ static proc_list_t    runq;
  */
 static proc_list_t    susq;
 
+/*!
+ * \brief Wake up a suspended process. Remove it from susq and insert it
+ * to the "correct" place in runq, based on its niceness.
+ *
+ * \param wp Pointer to the process to wake up.
+ */
+static void sch_wake (process_t *wp)
+{
+   process_t *p;
+   uint8_t  ins=0;
+
+   sch_list_remove (&susq, wp);  // Remove it from susq
+   wp->susp = 0;
+
+   if (sch_runq_empty ())        // No others
+      sch_list_ins_front (&runq, wp);
+   else                          // There is others, check niceness.
+   {
+      /*
+       * Find first spot in front of a non zero time_slice process
+       * with bigger niceness than wp.
+       * \note
+       *    We leave zero time_slice process out, because the rest of
+       *    the scheduler will roll them.
+       */
+      p = runq.head;
+      ins = 1;
+      while (ins && p)
+      {
+         if (p->time_slice && (wp->nice < p->nice))
+         {
+            sch_list_ins (&runq, wp, p);
+            ins = 0;
+         }
+         p = p->next;
+      }
+      if (ins)                   // All items was meaner than wp
+         sch_list_ins_back (&runq, wp);
+   }
+}
+
+/*!
+ * \brief Wake up the processes notified by notify(). This does not scan
+ * the susq. notify() marks the pid in kernel_vars.notified and we move
+ * each marked process, if it still waits for the notification, straight
+ * to runq.
+ */
+static void sch_notified (void)
+{
+   uint32_t n = katomic_fetch_and (&kernel_vars.notified, 0);
+   process_t *p;
+
+   while (n)
+   {
+      p = proc_get_process ((pid_t)__builtin_ctz (n));
+      n &= n-1;
+      if (p && p->susp && p->wait == WAIT_NOTIFY)
+      {
+         KTRACE (KTR_WAKE, p->id, p->wait);
+         // Release the process from shackles
+         p->alarm = 0;
+         p->wait = WAIT_NONE;
+         sch_wake (p);
+      }
+      /*
+       * \note
+       * If the process is not yet in susq, it will be found by
+       * sch_alarm() after it suspends.
+       */
+   }
+}
+
 /*!
  * \brief pkernel's Scheduler.
  * This is a round robin scheduler with some extras. When called:
+ * - Wake up the notified processes.
  * - Check if we have a suspended process that needs to wake up in susq.
  * - Check priorities between the suspended process and current process
  * - Wake up by inserting the process to the "correct" place in runq and
@@ -50,44 +125,17 @@ static proc_list_t    susq;
  */
 pid_t schedule(void)
 {
-   process_t *p, *wp = sch_alarm ();
+   process_t *p, *wp;
    pid_t pid;
-   uint8_t  ins=0;
 
+   if (kernel_vars.notified)
+      sch_notified ();
    /*
     * If we have a awakened process, we have to put
     * it somewhere. So we look the niceness.
     */
-   if (wp)
-   {
-      sch_list_remove (&susq, wp);  // Remove it from susq
-
-      if (sch_runq_empty ())        // No others
-         sch_list_ins_front (&runq, wp);
-      else                          // There is others, check niceness.
-      {
-         /*
-          * Find first spot in front of a non zero time_slice process
-          * with bigger niceness than wp.
-          * \note
-          *    We leave zero time_slice process out, because the rest of
-          *    the scheduler will roll them.
-          */
-         p = runq.head;
-         ins = 1;
-         while (ins && p)
-         {
-            if (p->time_slice && (wp->nice < p->nice))
-            {
-               sch_list_ins (&runq, wp, p);
-               ins = 0;
-            }
-            p = p->next;
-         }
-         if (ins)                   // All items was meaner than wp
-            sch_list_ins_back (&runq, wp);
-      }
-   }
+   if ((wp = sch_alarm ()) != 0)
+      sch_wake (wp);
 
    // If we still have no processes, switch to idle
    if (sch_runq_empty ())
@@ -110,20 +158,142 @@ pid_t schedule(void)
    else
       pid = runq.head->id;
 
+   proc_account (pid);
+   if (pid != kernel_vars.cur_pid)
+      KTRACE (KTR_SWITCH, pid, kernel_vars.cur_pid);
    // return to the selected process.
    return pid;
 }
 
+/*!
+ * \brief Wake up policy for a process suspended on a condition variable.
+ * If the condition has a pending signal, select the waiter with the
+ * higher priority (smaller nice) and consume the signal. Between waiters
+ * with the same niceness the first suspended wins.
+ *
+ * \param p The first process in susq waiting for the condition.
+ * \return Pointer to process that has to wake up or NULL there is none.
+ */
+static process_t* sch_cond_grant (process_t *p)
+{
+   cond_t *c = (cond_t*)p->wobj;
+   process_t *q;
+
+   if (c->signals <= 0)
+      return (process_t*)0;
+
+   for (q=p->next ; q ; q=q->next)
+      if (q->wait == WAIT_COND && q->wobj == p->wobj && q->nice < p->nice)
+         p = q;
+   katomic_fetch_add (&c->signals, -1);
+   katomic_fetch_add (&c->waiters, -1);
+   return p;
+}
+
+/*!
+ * \brief Wake up policy for a process suspended on a reader-writer lock.
+ * The lock is granted here, so the woken process does not have to race
+ * for it.
+ * - A reader is counted in when there is no writer holding or waiting.
+ * - A writer takes the lock when there is no writer and no reader.
+ * - A draining writer already holds the lock and waits for the readers.
+ *
+ * \param p The process waiting for the lock.
+ * \return Pointer to process that has to wake up or NULL there is none.
+ */
+static process_t* sch_rw_grant (process_t *p)
+{
+   rwlock_t *l = (rwlock_t*)p->wobj;
+
+   switch (p->wait)
+   {
+      case WAIT_RDLOCK:
+         if (l->writer || l->wwait)
+            return (process_t*)0;
+         katomic_fetch_add (&l->readers, 1);
+         return p;
+      case WAIT_WRLOCK:
+         if (l->writer || l->readers)
+            return (process_t*)0;
+         l->writer = 1;
+         katomic_fetch_add (&l->wwait, -1);
+         return p;
+      default:
+      case WAIT_WRDRAIN:
+         return (l->readers) ? (process_t*)0 : p;
+   }
+}
+
+/*!
+ * \brief Wake up policy for a process suspended in kpoll().
+ * The process wakes up if any of the objects is ready. The object is
+ * taken by the process itself after the wake up.
+ *
+ * \param p The process waiting in kpoll().
+ * \return Pointer to process that has to wake up or NULL there is none.
+ */
+static process_t* sch_poll_grant (process_t *p)
+{
+   kpollset_t *set = (kpollset_t*)p->wobj;
+   kpoll_t *it;
+
+   for (it = set->items ; it < set->items + set->n ; ++it)
+      switch (it->type)
+      {
+         case POLL_SEM:
+         case POLL_MUT:
+            if (((sem_t*)it->obj)->val > 0)
+               return p;
+            break;
+         case POLL_NOTIFY:
+            if (p->notify & it->mask)
+               return p;
+            break;
+         case POLL_TOPIC:
+            if (sub_available ((sub_t*)it->obj))
+               return p;
+            break;
+         default:
+            break;
+      }
+   return (process_t*)0;
+}
+
+/*!
+ * \brief Check if a process suspended on a kernel object (\sa wait_en)
+ * can wake up.
+ *
+ * \param p The suspended process.
+ * \return Pointer to process that has to wake up or NULL there is none.
+ * \note The returned process may be other than \a p, if both wait for
+ * the same object.
+ */
+static process_t* sch_wait_grant (process_t *p)
+{
+   switch (p->wait)
+   {
+      case WAIT_COND:   return sch_cond_grant (p);
+      case WAIT_RDLOCK:
+      case WAIT_WRLOCK:
+      case WAIT_WRDRAIN: return sch_rw_grant (p);
+      case WAIT_NOTIFY: return (p->notify & p->nmask) ? p : (process_t*)0;
+      case WAIT_TOPIC:  return sub_available ((sub_t*)p->wobj) ? p : (process_t*)0;
+      case WAIT_POLL:   return sch_poll_grant (p);
+      default:          return p;
+   }
+}
+
 /*!
  * \brief Check if there is a process in susq needs to awake.
  * - Check if a process, suspended by sleep() has expire it's sleep time.
  * - Check if a process, suspended by wait() / lock(), has a positive semaphore value now.
+ * - Check if a process, suspended on a kernel object, can be granted that object.
  *
  * \return Pointer to process that has to wake up or NULL there is none.
  */
 process_t* sch_alarm (void)
 {
-   process_t *p=(process_t*)0;
+   process_t *p=(process_t*)0, *wp;
    uint8_t  wu = 0;   // wakeup flag
 
    if (sch_susq_empty())
@@ -135,20 +305,34 @@ process_t* sch_alarm (void)
       else
          p =p->next;
       /*
-       * If Alarm       then alarm <= Ticks
+       * If Alarm       then alarm has passed (wrap safe)
        * If Semaphore   then Value > 0
+       * If Object      then granted, or alarm has passed as timeout
        */
-      wu = 0;
-      if (!p->alarm || p->alarm <= Ticks)
-         ++wu;
-      if (!p->sem || (p->sem && p->sem->val>0))
-         ++wu;
-      if (wu>1)
+      if (p->wait)
       {
+         wp = sch_wait_grant (p);
+         if (!wp && p->alarm && ktime_passed (p->alarm))
+            wp = p;
+      }
+      else
+      {
+         wu = 0;
+         if (!p->alarm || ktime_passed (p->alarm))
+            ++wu;
+         if (!p->sem || (p->sem && p->sem->val>0))
+            ++wu;
+         wp = (wu>1) ? p : (process_t*)0;
+      }
+      if (wp)
+      {
+         KTRACE (KTR_WAKE, wp->id, wp->wait);
          // Release the process from shackles
-         p->alarm = 0;
-         p->sem = (void*)0;
-         return p;
+         wp->alarm = 0;
+         wp->sem = (void*)0;
+         wp->wait = WAIT_NONE;
+         wp->wobj = (void*)0;
+         return wp;
       }
 
    } while (p->next);
@@ -156,6 +340,49 @@ process_t* sch_alarm (void)
    return (process_t*)0;
 }
 
+/*!
+ * \brief Rescale the alarms of the suspended processes after a tick
+ * frequency change, so they keep their real time duration.
+ *
+ * \param fo  The old tick frequency.
+ * \param fn  The new tick frequency.
+ * \note Call with the kernel ISRs masked.
+ */
+void sch_rescale (clock_t fo, clock_t fn)
+{
+   process_t *p;
+   clock_t a;
+
+   for (p=susq.head ; p ; p=p->next)
+      if (p->alarm && !ktime_passed (p->alarm)) {
+         a = Ticks + kticks_rescale (p->alarm - Ticks, fo, fn);
+         p->alarm = (a) ? a : 1;
+      }
+}
+
+/*!
+ * \brief Return the ticks until the earliest alarm of the suspended
+ * processes. Sleeps, timeouts and the daemons' waits are all alarms.
+ *
+ * \return The ticks to the next alarm, 0 if one has passed, or
+ * (clock_t)-1 if there is none.
+ * \note Call with the kernel ISRs masked.
+ */
+clock_t sch_next_alarm (void)
+{
+   process_t *p;
+   clock_t d, min = (clock_t)-1;
+
+   for (p=susq.head ; p ; p=p->next)
+      if (p->alarm) {
+         if (ktime_passed (p->alarm))
+            return 0;
+         if ((d = p->alarm - Ticks) < min)
+            min = d;
+      }
+   return min;
+}
+
 /*!
  * \brief Add a process at the end of the runq
  */
@@ -264,6 +491,7 @@ void sch_susp_proc (process_t *p)
 {
    sch_list_remove (&runq, p);
    sch_list_ins_back (&susq, p);
+   p->susp = 1;
 }
 
 /*!
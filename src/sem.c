@@ -23,6 +23,15 @@
  */
 
 #include <sem.h>
+#include <os.h>
+#include <string.h>
+
+#ifdef PKERNEL_LOCKSTAT
+/*!
+ * The registered lock statistics. The kernel spin locks are always there.
+ */
+static klockstat_t *klock_list = &__proc_lockstat;
+#endif
 
 /*!
  * \brief
@@ -34,6 +43,9 @@
 static void _sinit (sem_t *s, int v) {
    if (s) {
       s->val = v;
+#ifdef PKERNEL_LOCKSTAT
+      s->stat = NULL;
+#endif
    }
 }
 
@@ -81,15 +93,15 @@ int sem_getvalue (sem_t *s) {
  * \param  s        Pointer to semaphore used
  * \return true     For positive semaphore value.
  *
- * \note Thread safe, not reentrant.
+ * \note Thread safe, ISR safe. Lock free.
  */
 int sem_check (sem_t *s) {
-    if (s->val > 0) {
-        --s->val;
-        return 1;
-    }
-    else
-        return 0;
+    int v = s->val;
+
+    while (v > 0)
+        if (katomic_cas (&s->val, &v, v-1))
+            return 1;
+    return 0;
 }
 
 /*!
@@ -125,16 +137,229 @@ int mut_close (sem_t *m) {
 *    \arg  0  Fail to lock, mutex already locked
 *    \arg  1  Success, mutex is locked by the function
 *
-* \note Thread safe, not reentrant.
+* \note Thread safe, ISR safe. Lock free.
 */
 int mut_trylock (sem_t *m) {
-    if (m->val > 0) {
-        m->val = 0;
-        return 1;
-    }
-    else
-        return 0;
+    int v = 1;
+
+#ifdef PKERNEL_LOCKSTAT
+    if (!katomic_cas (&m->val, &v, 0))
+       return 0;
+    if (m->stat)
+       klock_account (m->stat, 0, 0);
+    return 1;
+#else
+    return katomic_cas (&m->val, &v, 0);
+#endif
+}
+
+/*!
+ * \brief
+ *    Attach contention statistics to a mutex and register them for
+ *    klock_stats(). Call it after mut_init().
+ * \note
+ *    The statistics stay registered, so they must outlive the mutex.
+ *    Static mutexes are not attached by their initializer, call it
+ *    for them too. Without PKERNEL_LOCKSTAT this does nothing.
+ *
+ * \param m     Pointer to mutex
+ * \param st    Pointer to the statistics storage
+ * \param name  The name to report
+ */
+void mut_stat (sem_t *m, klockstat_t *st, const char *name) {
+#ifdef PKERNEL_LOCKSTAT
+   if (!m || !st)
+      return;
+   memset (st, 0, sizeof (*st));
+   st->name = name;
+   __os_mask_ISR();
+   st->next = klock_list;
+   klock_list = st;
+   m->stat = st;
+   __os_unmask_ISR();
+#else
+   (void)m; (void)st; (void)name;
+#endif
+}
+
+/*!
+ * \brief
+ *    Account an acquisition of a lock. Called by the new owner, so the
+ *    lock itself serializes the update.
+ *
+ * \param st         The lock's statistics
+ * \param contended  True if the owner had to wait
+ * \param ns         The wait
+ */
+void klock_account (klockstat_t *st, int contended, uint64_t ns) {
+   ++st->acq;
+   if (!contended)
+      return;
+   ++st->contended;
+   st->wait_ns += ns;
+   if (ns > st->max_ns) {
+      st->max_ns = ns;
+      st->max_pid = proc_get_current_pid ();
+   }
+}
+
+/*!
+ * \brief
+ *    Read the lock contention statistics. These are the kernel spin locks,
+ *    __proc_lock and __malloc_lock, and the mutexes attached with mut_stat().
+ *
+ * \param st     Pointer to an array to fill, or NULL to count
+ * \param n      The array size
+ * \param clear  If true, restart the counters.
+ * \return The number of registered locks. 0 without PKERNEL_LOCKSTAT.
+ * \note A lock acquired while we read may show a torn entry.
+ */
+int klock_stats (klockstat_t *st, int n, int clear) {
+#ifdef PKERNEL_LOCKSTAT
+   klockstat_t *l;
+   const char *name;
+   int i;
+
+   for (l=klock_list, i=0 ; l ; l=l->next, ++i) {
+      if (st && i<n) {
+         st[i] = *l;
+         st[i].next = NULL;
+      }
+      if (clear) {
+         name = l->name;
+         memset (l, 0, offsetof (klockstat_t, next));
+         l->name = name;
+      }
+   }
+   return i;
+#else
+   (void)st; (void)n; (void)clear;
+   return 0;
+#endif
+}
+
+/*!
+ * \brief
+ *    Open/Initialize a condition variable.
+ * \note
+ *    A condition variable has no value. It holds only the number of
+ *    the waiting processes and the pending wake ups.
+ *
+ * \param c    Pointer to condition variable to initialize
+ */
+void cond_init (cond_t *c) {
+   if (c) {
+      c->waiters = 0;
+      c->signals = 0;
+   }
+}
+
+/*!
+ * \brief
+ *    Close/De-Initialize a condition variable.
+ *
+ * \param   c    Pointer to condition variable to close
+ * \return  0
+ */
+int cond_close (cond_t *c) {
+   c->signals = 0;
+   return c->waiters = 0;
+}
+
+/*!
+ * \brief
+ *    Open/Initialize a reader-writer lock. The lock is initialized unlocked.
+ *
+ * \param l    Pointer to reader-writer lock to initialize
+ */
+void rw_init (rwlock_t *l) {
+   if (l) {
+      l->readers = 0;
+      l->writer = 0;
+      l->wwait = 0;
+   }
+}
+
+/*!
+ * \brief
+ *    Close/De-Initialize a reader-writer lock.
+ *
+ * \param   l    Pointer to reader-writer lock to close
+ * \return  0
+ */
+int rw_close (rwlock_t *l) {
+   l->writer = 0;
+   l->wwait = 0;
+   return l->readers = 0;
+}
+
+/*!
+ * \brief
+ *    This function tries to lock a reader-writer lock for reading.
+ *    Writers have preference, so the function fails if a writer holds
+ *    the lock or waits for it.
+ *
+ * \param  l     Pointer to reader-writer lock used
+ * \return the status of the operation
+ *    \arg  0  Fail to lock
+ *    \arg  1  Success, the caller is counted as reader
+ *
+ * \note Thread safe, not reentrant. Does not enter the kernel.
+ */
+int rw_tryrdlock (rwlock_t *l) {
+   if (l->writer || l->wwait)
+      return 0;
+   katomic_fetch_add (&l->readers, 1);
+   if (!l->writer)
+      return 1;
+   /*
+    * A writer took the lock between the check and our increment.
+    * The writer sees us and waits to drain, so back off.
+    */
+   katomic_fetch_add (&l->readers, -1);
+   return 0;
 }
 
+/*!
+ * \brief
+ *    This function tries to lock a reader-writer lock for writing.
+ *
+ * \param  l     Pointer to reader-writer lock used
+ * \return the status of the operation
+ *    \arg  0  Fail to lock, there are readers or another writer
+ *    \arg  1  Success, the lock is held by the caller
+ *
+ * \note Thread safe, not reentrant. Does not enter the kernel.
+ */
+int rw_trywrlock (rwlock_t *l) {
+   int w = 0;
+
+   if (!katomic_cas (&l->writer, &w, 1))
+      return 0;
+   if (!l->readers)
+      return 1;
+   l->writer = 0;
+   return 0;
+}
 
+/*!
+ * \brief
+ *    Release a read lock, but leave the OS to awake any waiting writer.
+ *
+ * \param  l     Pointer to reader-writer lock used
+ * \note Thread safe, not reentrant. Does not enter the kernel.
+ */
+void rw_rdunlock (rwlock_t *l) {
+   katomic_fetch_add (&l->readers, -1);
+}
 
+/*!
+ * \brief
+ *    Release a write lock, but leave the OS to awake any waiting process.
+ *
+ * \param  l     Pointer to reader-writer lock used
+ * \note Thread safe, not reentrant. Does not enter the kernel.
+ */
+void rw_wrunlock (rwlock_t *l) {
+   l->writer = 0;
+}
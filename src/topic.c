@@ -0,0 +1,149 @@
+/*
+ * topic.c : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+#include <topic.h>
+#include <string.h>
+
+/*!
+ * \brief
+ *    Open/Initialize a topic.
+ *
+ * \param t      Pointer to topic to initialize
+ * \param buf    Pointer to the ring buffer. It must hold \a depth * \a size bytes.
+ * \param size   The size of each message in bytes.
+ * \param depth  The number of messages the ring holds. A power of 2, so the
+ *               slot of a sequence number stays in step when it wraps.
+ * \return 0 on success, -1 on invalid arguments.
+ */
+int topic_init (topic_t *t, void *buf, size_t size, uint32_t depth) {
+   if (!t || !buf || !size || !depth || (depth & (depth-1)))
+      return -1;
+   t->buf = (uint8_t*)buf;
+   t->size = size;
+   t->depth = depth;
+   t->head = 0;
+   return 0;
+}
+
+/*!
+ * \brief
+ *    Close/De-Initialize a topic. The subscribers must not be used after that.
+ *
+ * \param   t    Pointer to topic to close
+ * \return  0
+ */
+int topic_close (topic_t *t) {
+   t->buf = (uint8_t*)0;
+   t->depth = 0;
+   return t->head = 0;
+}
+
+/*!
+ * \brief
+ *    Publish a message to the topic. The message is copied once in the
+ *    ring and the publisher never waits for the subscribers. The cost
+ *    does not depend on the number of subscribers.
+ *
+ * \param t      Pointer to topic used
+ * \param msg    Pointer to the message. \a t->size bytes are copied.
+ *
+ * \note
+ *    A topic has one publisher. Safe to call from ISRs.
+ * \note
+ *    We leave next tick's scheduler to awake the waiting subscribers.
+ */
+void publish (topic_t *t, const void *msg) {
+   uint32_t h = t->head;
+
+   memcpy (t->buf + (h & (t->depth-1)) * t->size, msg, t->size);
+   t->head = h+1;    // make the message visible
+}
+
+/*!
+ * \brief
+ *    Open/Initialize a subscriber. The subscriber sees only the
+ *    messages published after this call.
+ *
+ * \param s      Pointer to subscriber to initialize
+ * \param t      Pointer to topic to subscribe to
+ */
+void sub_init (sub_t *s, topic_t *t) {
+   if (s) {
+      s->topic = t;
+      s->cursor = t->head;
+      s->overrun = 0;
+   }
+}
+
+/*!
+ * \brief
+ *    Get the number of messages waiting for the subscriber. If the
+ *    subscriber has been overrun, this is the ring's depth.
+ *
+ * \param  s  Pointer to subscriber used
+ * \return The number of messages available to read
+ */
+int sub_available (sub_t *s) {
+   uint32_t lag = s->topic->head - s->cursor;
+
+   return (lag > s->topic->depth) ? (int)s->topic->depth : (int)lag;
+}
+
+/*!
+ * \brief
+ *    Read the next message of the subscriber, if any. If the publisher
+ *    has overwritten messages we did not read, we skip them and add
+ *    them to the subscriber's overrun counter.
+ *
+ * \param  s     Pointer to subscriber used
+ * \param  msg   Pointer to buffer for the message. \a size bytes are copied.
+ * \return true if a message was read, false if there was none.
+ *
+ * \note Thread safe, not reentrant for the same subscriber.
+ */
+int sub_tryread (sub_t *s, void *msg) {
+   topic_t *t = s->topic;
+   uint32_t lag;
+
+   while ((lag = t->head - s->cursor) != 0) {
+      if (lag >= t->depth) {
+         /*
+          * The slot of the cursor is the next one the publisher
+          * writes. Skip to the oldest message that is safe to read.
+          */
+         s->overrun += lag - t->depth + 1;
+         s->cursor += lag - t->depth + 1;
+      }
+      memcpy (msg, t->buf + (s->cursor & (t->depth-1)) * t->size, t->size);
+      /*
+       * If the publisher reached our slot while we copied the message
+       * is corrupted. Retry with the overrun accounting above.
+       */
+      if (t->head - s->cursor < t->depth) {
+         ++s->cursor;
+         return 1;
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,17 @@
+/*
+ * time.h for the host tests. The target's clock_t is 32-bit.
+ */
+#ifndef __host_time_h__
+#define __host_time_h__
+
+#include <stdint.h>
+
+typedef uint32_t clock_t;
+typedef int32_t  time_t;
+
+struct timespec {
+   time_t   tv_sec;
+   long     tv_nsec;
+};
+
+#endif
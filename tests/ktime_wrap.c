@@ -0,0 +1,89 @@
+/*
+ * ktime_wrap.c : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+/*
+ * Host test of the tick counter wrap. Build and run with make -C tests.
+ * tests/host/time.h makes clock_t 32-bit, as on the target.
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+static uint32_t masked;       /* The emulated PRIMASK */
+static int wrap_masked;       /* The wrap stores ran masked */
+
+#define KTIME_IRQ_SAVE(_pm)      do { (_pm) = masked; masked = 1; } while (0)
+#define KTIME_IRQ_RESTORE(_pm)   do { wrap_masked = masked && !Ticks; masked = (_pm); } while (0)
+
+#include <ktime.h>
+
+clock_t  volatile Ticks;
+clock_t  volatile Ticks_hi;
+
+static int fails;
+
+#define CHECK(_c)                                                    \
+   do {                                                              \
+      if (!(_c)) {                                                   \
+         printf ("%s:%d: %s failed at Ticks 0x%08lx\n", __FILE__,    \
+                 __LINE__, #_c, (unsigned long)Ticks);               \
+         ++fails;                                                    \
+      }                                                              \
+   } while (0)
+
+int main (void)
+{
+   clock_t alarm, zero;
+   uint64_t t, last;
+   int i;
+
+   Ticks = 0xFFFFFFF0;
+   Ticks_hi = 0;
+   alarm = ktime_alarm (20);     // 0x00000004, past the wrap
+   zero = ktime_alarm (0x10);    // Lands on 0, must not be 0
+   CHECK (alarm == 4);
+   CHECK (zero == 1);
+   CHECK (!ktime_passed (alarm));
+   CHECK (ktime_passed (0xFFFFFFE0));
+   CHECK (ktime_before (0xFFFFFFF0, alarm));
+   CHECK (!ktime_before (alarm, 0xFFFFFFF0));
+   CHECK (!ktime_before (alarm, alarm));
+
+   last = ktime_read64 ();
+   CHECK (last == 0xFFFFFFF0ULL);
+   for (i=1 ; i<=32 ; ++i) {
+      ktime_tick ();
+      t = ktime_read64 ();
+      CHECK (t == last + 1);
+      CHECK (ktime_passed (alarm) == (i >= 20));
+      CHECK (ktime_passed (zero) == (i >= 17));
+      last = t;
+   }
+   CHECK (Ticks_hi == 1);
+   CHECK (Ticks == 0x10);
+   CHECK (wrap_masked);
+   CHECK (!masked);
+
+   printf ("ktime_wrap: %s\n", (fails) ? "FAIL" : "ok");
+   return fails != 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * sched_wrap.c : This file is part of pkernel
+ *
+ * Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+ * Date:       10/2026
+ * Version:
+ *
+ */
+
+/*
+ * Host test of the tick wrap in the code that uses the tick helpers:
+ * a sleep deadline through sch_alarm() and the service due ticks through
+ * services(), with a service that removes itself. It links src/sched.c
+ * and src/cron.c, the rest of the kernel is stubbed below. Build and run
+ * with make -C tests.
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#define KTIME_IRQ_SAVE(_pm)      do { (_pm) = 0; } while (0)
+#define KTIME_IRQ_RESTORE(_pm)   do { (void)(_pm); } while (0)
+
+#include <os.h>
+
+clock_t  volatile Ticks;
+clock_t  volatile Ticks_hi;
+time_t   volatile Now;
+clock_t  volatile Now_left;
+kernel_var_t      kernel_vars;
+
+static process_t  proc;       /* The sleeping process */
+
+/*
+ * Stubs of the kernel parts that sched.c and cron.c call
+ */
+process_t *proc_get_process (pid_t pid) { (void)pid; return &proc; }
+void proc_rst_ticks (pid_t pid) { (void)pid; }
+void proc_account (pid_t pid) { (void)pid; }
+pid_t proc_search_pid (process_ptr_t fptr) { (void)fptr; return 0; }
+int sub_available (sub_t *s) { (void)s; return 0; }
+clock_t get_freq (void) { return 1000; }
+pid_t knew (process_ptr_t fptr, size_t mem, int8_t nice, int8_t fit) {
+   (void)fptr; (void)mem; (void)nice; (void)fit; return 0;
+}
+void mut_lock (sem_t *m) { (void)m; }
+void mut_unlock (sem_t *m) { (void)m; }
+int notify (pid_t pid, uint32_t bits, notify_action_en action) {
+   (void)pid; (void)bits; (void)action; return 0;
+}
+uint32_t notify_wait (uint32_t mask, clock_t timeout) { (void)mask; (void)timeout; return 0; }
+time_t time (time_t *t) { (void)t; return Now; }
+
+static int fails;
+
+#define CHECK(_c)                                                    \
+   do {                                                              \
+      if (!(_c)) {                                                   \
+         printf ("%s:%d: %s failed at Ticks 0x%08lx\n", __FILE__,    \
+                 __LINE__, #_c, (unsigned long)Ticks);               \
+         ++fails;                                                    \
+      }                                                              \
+   } while (0)
+
+static clock_t s8_last, s5_last;
+static int s8_runs, s5_runs, s1_runs;
+
+static void serv8 (void)
+{
+   CHECK (Ticks % 8 == 0);
+   CHECK (!s8_runs || Ticks - s8_last == 8);
+   s8_last = Ticks;
+   ++s8_runs;
+}
+
+static void serv5 (void)
+{
+   CHECK (!s5_runs || Ticks - s5_last == 5);
+   s5_last = Ticks;
+   ++s5_runs;
+}
+
+static void serv1 (void)
+{
+   ++s1_runs;
+   service_rem (serv1);      // A service that removes itself
+}
+
+int main (void)
+{
+   process_t *wp;
+   int i, woke = 0;
+
+   Ticks = 0xFFFFFFF0;
+
+   // A sleep (20) as sleep() starts it, the deadline is past the wrap
+   proc.id = 1;
+   sch_add_proc (1);
+   proc.alarm = ktime_alarm (20);
+   sch_susp_proc (&proc);
+
+   service_add (serv8, 8);
+   service_add (serv5, 5);
+   service_add (serv1, 1);
+
+   for (i=1 ; i<=32 ; ++i) {
+      ktime_tick ();
+      // The scheduler wakes the process sch_alarm() returns, so ask once
+      if (!woke && (wp = sch_alarm ()) != 0) {
+         CHECK (wp == &proc && i == 20);
+         ++woke;
+      }
+      services ();
+   }
+   CHECK (Ticks == 0x10);
+   CHECK (woke == 1);
+   CHECK (s8_runs == 4);      // 0xFFFFFFF8, 0, 8, 0x10
+   CHECK (s5_runs == 6);
+   CHECK (s1_runs == 1);
+   CHECK (service_next () != 0);
+
+   printf ("sched_wrap: %s\n", (fails) ? "FAIL" : "ok");
+   return fails != 0;
+}
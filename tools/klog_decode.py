@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+#
+# klog_decode.py : This file is part of pkernel
+#
+# Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation, either version 3
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+# Date:       10/2026
+#
+
+"""Format a pkernel deferred log (klog_t) on the host.
+
+The input is the elf of the application and the file written by
+klog_drain() through semihosting, or a raw memory dump that contains
+klog_buf. The header is found by its magic. The format strings come from
+the .klog_fmt section of the elf, the %s strings from its other sections.
+
+    klog_decode.py app.elf klog.bin
+    klog_decode.py --clk 72000000 app.elf ram.bin   cpu clock, if the dump has none
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+MAGIC = 0x474F4C4B
+HEADER = struct.Struct("<IHHIII")
+MAX_ARGS = 7
+CONV = re.compile(r"%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z|t|j)?([diouxXcsp%])")
+
+
+class Elf:
+    """The allocated sections of an elf, enough to read constant strings."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            d = f.read()
+        if d[:4] != b"\x7fELF" or d[5] != 1:
+            sys.exit("klog: %s is not a little endian elf" % path)
+        if d[4] == 1:
+            shoff, = struct.unpack_from("<I", d, 0x20)
+            shentsize, shnum, shstrndx = struct.unpack_from("<HHH", d, 0x2E)
+            sh = lambda i: struct.unpack_from("<IIIIII", d, shoff + i * shentsize)
+        else:
+            shoff, = struct.unpack_from("<Q", d, 0x28)
+            shentsize, shnum, shstrndx = struct.unpack_from("<HHH", d, 0x3A)
+            sh = lambda i: struct.unpack_from("<IIQQQQ", d, shoff + i * shentsize)
+        names = sh(shstrndx)[4]
+        self.sec = {}
+        for i in range(shnum):
+            name, typ, flags, addr, off, size = sh(i)
+            name = d[names + name:d.index(b"\0", names + name)].decode()
+            if typ != 8 and size:            # not NOBITS
+                self.sec[name] = (addr, d[off:off + size])
+
+    def string(self, addr):
+        for base, data in self.sec.values():
+            if base and base <= addr < base + len(data):
+                o = addr - base
+                return data[o:data.index(b"\0", o)].decode(errors="replace")
+        return None
+
+    def formats(self):
+        """Return {id: format} from .klog_fmt. The id is the 8 aligned address."""
+        if ".klog_fmt" not in self.sec:
+            sys.exit("klog: the elf has no .klog_fmt section")
+        base, data = self.sec[".klog_fmt"]
+        fmts, o = {}, 0
+        while o < len(data):
+            e = data.index(b"\0", o)
+            if e > o:
+                fmts[base + o] = data[o:e].decode(errors="replace")
+            o = (e + 8) & ~7
+        return fmts
+
+
+def nargs(fmt):
+    return sum(1 for m in CONV.finditer(fmt) if m.group(3) != "%")
+
+
+def render(elf, fmt, args):
+    it = iter(args)
+
+    def conv(m):
+        flags, c = m.group(1), m.group(3)
+        if c == "%":
+            return "%"
+        v = next(it)
+        if c in "di":
+            return ("%" + flags + "d") % (v - (1 << 32) if v & 0x80000000 else v)
+        if c == "s":
+            s = elf.string(v)
+            return ("%" + flags + "s") % (s if s is not None else "<0x%08x>" % v)
+        if c == "c":
+            return chr(v & 0xFF)
+        if c == "p":
+            return "0x%08x" % v
+        return ("%" + flags + c) % v
+    return CONV.sub(conv, fmt)
+
+
+def load(data, clk):
+    """Return (clk, words in write order, skipped words)."""
+    off = data.find(struct.pack("<I", MAGIC))
+    if off < 0:
+        sys.exit("klog: no log header found")
+    _, ver, rec, size, head, hclk = HEADER.unpack_from(data, off)
+    if ver != 1 or rec != 4:
+        sys.exit("klog: unknown log version %d/%d" % (ver, rec))
+    clk = clk or hclk
+    if not clk:
+        sys.exit("klog: the dump has no cpu clock, use --clk")
+    base = off + HEADER.size
+    n = min(head, size)
+    words = [struct.unpack_from("<I", data, base + 4 * (seq % size))[0]
+             for seq in range(head - n, head)]
+    return clk, words, head - n
+
+
+def decode(elf, fmts, words):
+    """Yield (cycles, message). Skip to the next valid format id on a torn record."""
+    i, hi, last, lost = 0, 0, None, 0
+    while i + 1 < len(words):
+        w = words[i]
+        fmt = fmts.get(w & ~MAX_ARGS)
+        n = w & MAX_ARGS
+        if fmt is None or nargs(fmt) != n or i + 2 + n > len(words):
+            i += 1
+            lost += 1
+            continue
+        ts = words[i + 1]
+        if last is not None and ts < last and last - ts > 0x80000000:
+            hi += 1 << 32
+        last = ts
+        yield hi + ts, render(elf, fmt, words[i + 2:i + 2 + n])
+        i += 2 + n
+    if lost:
+        print("# %d words did not decode" % lost)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("elf")
+    ap.add_argument("file")
+    ap.add_argument("--clk", type=int, default=0, help="cpu clock in Hz")
+    a = ap.parse_args()
+    elf = Elf(a.elf)
+    fmts = elf.formats()
+    with open(a.file, "rb") as f:
+        clk, words, over = load(f.read(), a.clk)
+    if over:
+        print("# %d older words were overwritten" % over)
+    t0 = None
+    for ts, msg in decode(elf, fmts, words):
+        t0 = ts if t0 is None else t0
+        print("%12.3f us  %s" % ((ts - t0) * 1e6 / clk, msg))
+
+
+if __name__ == "__main__":
+    main()
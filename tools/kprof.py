@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+#
+# kprof.py : This file is part of pkernel
+#
+# Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation, either version 3
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+# Date:       10/2026
+#
+
+"""Symbolize a pkernel profiler histogram (kprof_t) against the elf.
+
+The input is the file written by kprof_drain() through semihosting, or a
+raw memory dump that contains kprof_buf. The header is found by its magic.
+Each bucket is mapped to the function that contains it with nm, or to the
+source line with addr2line. A bucket that spans two functions is reported
+under both names, "a|b". Build with a small PKERNEL_PROF_SHIFT for --lines.
+
+    kprof.py app.elf kprof.bin                  flat profile
+    kprof.py --pid app.elf kprof.bin            flat profile per process
+    kprof.py --lines app.elf kprof.bin          hottest source lines
+    kprof.py --cross arm-none-eabi- app.elf ram.bin
+"""
+
+import argparse
+import bisect
+import struct
+import subprocess
+import sys
+
+MAGIC = 0x4652504B
+HEADER = struct.Struct("<IHHIIIIIIB3x")
+
+
+def load(data):
+    """Return (header dict, [(pc, pid, cnt)])."""
+    off = data.find(struct.pack("<I", MAGIC))
+    if off < 0:
+        sys.exit("kprof: no profiler header found")
+    _, ver, rec, size, shift, hz, samples, isr, lost, _ = HEADER.unpack_from(data, off)
+    if ver != 1 or rec != 8:
+        sys.exit("kprof: unknown profiler version %d/%d" % (ver, rec))
+    base = off + HEADER.size
+    ents = []
+    for i in range(size):
+        pc, pid, cnt = struct.unpack_from("<IHH", data, base + 8 * i)
+        if cnt:
+            ents.append((pc, pid, cnt))
+    hdr = dict(size=size, shift=shift, hz=hz, samples=samples, isr=isr, lost=lost)
+    return hdr, ents
+
+
+def symbols(cross, elf):
+    """Return the sorted function table [(start, end, name)] from nm."""
+    out = subprocess.run([cross + "nm", "-n", "-S", "-C", "--defined-only", elf],
+                         check=True, capture_output=True, text=True).stdout
+    syms = []
+    for line in out.splitlines():
+        f = line.split(None, 3)
+        if len(f) == 4 and f[2] in "tTwW":
+            start = int(f[0], 16) & ~1
+            syms.append((start, start + int(f[1], 16), f[3]))
+    return syms
+
+
+def lookup(syms, starts, pc, span):
+    """Name the functions that overlap the bucket [pc, pc+span)."""
+    names = []
+    i = bisect.bisect_right(starts, pc + span - 1) - 1
+    while i >= 0 and syms[i][1] > pc:
+        if syms[i][1] > syms[i][0]:
+            names.append(syms[i][2])
+        i -= 1
+    return "|".join(reversed(names)) or "0x%08x" % pc
+
+
+def lines(cross, elf, pcs):
+    """Return {pc: "file:line"} from addr2line."""
+    if not pcs:
+        return {}
+    out = subprocess.run([cross + "addr2line", "-e", elf] + ["0x%x" % p for p in pcs],
+                         check=True, capture_output=True, text=True).stdout
+    return dict(zip(pcs, out.splitlines()))
+
+
+def report(title, hist, total, top):
+    print("\n%8s %7s  %s" % ("samples", "%", title))
+    for key, cnt in sorted(hist.items(), key=lambda kv: -kv[1])[:top]:
+        print("%8d %7.2f  %s" % (cnt, 100.0 * cnt / total, key))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("elf")
+    ap.add_argument("file")
+    ap.add_argument("--cross", default="arm-none-eabi-", help="binutils prefix")
+    ap.add_argument("--pid", action="store_true", help="split the profile per process")
+    ap.add_argument("--lines", action="store_true", help="source lines instead of functions")
+    ap.add_argument("--top", type=int, default=40, help="rows to print")
+    a = ap.parse_args()
+    with open(a.file, "rb") as f:
+        hdr, ents = load(f.read())
+    total = sum(c for _, _, c in ents) or 1
+    print("# %d samples at %d Hz, %d in handlers, %d lost, %d byte buckets" % (
+        hdr["samples"], hdr["hz"], hdr["isr"], hdr["lost"], 1 << hdr["shift"]))
+    if any(c == 0xFFFF for _, _, c in ents):
+        print("# some buckets saturated, the shares are low for them")
+
+    if a.lines:
+        where = lines(a.cross, a.elf, sorted({pc for pc, _, _ in ents}))
+        name = lambda pc: where.get(pc, "0x%08x" % pc)
+    else:
+        syms = symbols(a.cross, a.elf)
+        starts = [s[0] for s in syms]
+        name = lambda pc: lookup(syms, starts, pc, 1 << hdr["shift"])
+
+    hist = {}
+    for pc, pid, cnt in ents:
+        key = ("pid %2d  " % pid if a.pid else "") + name(pc)
+        hist[key] = hist.get(key, 0) + cnt
+    report("line" if a.lines else "function", hist, total, a.top)
+
+
+if __name__ == "__main__":
+    main()
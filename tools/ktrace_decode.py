@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+#
+# ktrace_decode.py : This file is part of pkernel
+#
+# Copyright (C) 2013 Choutouridis Christos <houtouridis.ch@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation, either version 3
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Author:     Choutouridis Christos <houtouridis.ch@gmail.com>
+# Date:       10/2026
+#
+
+"""Decode a pkernel trace buffer (ktrace_t).
+
+The input is the file written by ktrace_drain() through semihosting, or a
+raw memory dump that contains ktrace_buf. The header is found by its magic.
+
+    ktrace_decode.py ktrace.bin              timeline and statistics
+    ktrace_decode.py --stats ram.bin         statistics only
+    ktrace_decode.py --clk 72000000 ram.bin  cpu clock, if the dump has none
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x4352544B
+HEADER = struct.Struct("<IHHIII")
+EVENTS = {1: "switch", 2: "wake", 3: "call", 4: "alloc", 5: "free",
+          6: "service", 7: "cron"}
+WAITS = ["sem/alarm", "cond", "rdlock", "wrlock", "wrdrain", "notify",
+         "topic", "poll"]
+CALLS = ["exit", "suspend"]
+
+
+def load(data, clk):
+    """Return (clk, events in write order). Events are (cycles, ev, pid, arg)."""
+    off = data.find(struct.pack("<I", MAGIC))
+    if off < 0:
+        sys.exit("ktrace: no trace header found")
+    _, ver, rec, size, head, hclk = HEADER.unpack_from(data, off)
+    if ver != 1 or rec != 8:
+        sys.exit("ktrace: unknown trace version %d/%d" % (ver, rec))
+    clk = clk or hclk
+    if not clk:
+        sys.exit("ktrace: the dump has no cpu clock, use --clk")
+    base = off + HEADER.size
+    n = min(head, size)
+    first = head - n
+    evs = []
+    for seq in range(first, head):
+        ts, ev, pid, arg = struct.unpack_from("<IBBH", data, base + 8 * (seq % size))
+        evs.append((ts, ev, pid, arg))
+    # Unwrap the 32-bit cycle counter
+    out, hi, last = [], 0, None
+    for ts, ev, pid, arg in evs:
+        if last is not None and ts < last and last - ts > 0x80000000:
+            hi += 1 << 32
+        last = ts
+        out.append((hi + ts, ev, pid, arg))
+    return clk, out, head - n
+
+
+def describe(ev, pid, arg):
+    name = EVENTS.get(ev, "user%d" % (ev - 0x80) if ev >= 0x80 else "ev%d" % ev)
+    if ev == 1:
+        return "%-8s pid %2d <- pid %d" % (name, pid, arg)
+    if ev == 2:
+        return "%-8s pid %2d (%s)" % (name, pid, WAITS[arg] if arg < len(WAITS) else arg)
+    if ev == 3:
+        return "%-8s pid %2d %s" % (name, pid, CALLS[arg] if arg < len(CALLS) else arg)
+    if ev == 6:
+        return "%-8s 0x....%04x" % (name, arg)
+    return "%-8s pid %2d arg %d" % (name, pid, arg)
+
+
+def stats(clk, evs):
+    run, sw, wake, call, alloc = {}, {}, {}, {}, {}
+    cur, since = None, None
+    for ts, ev, pid, arg in evs:
+        if ev == 1:
+            if cur is not None:
+                run[cur] = run.get(cur, 0) + ts - since
+            cur, since = pid, ts
+            sw[pid] = sw.get(pid, 0) + 1
+        elif ev == 2:
+            wake[pid] = wake.get(pid, 0) + 1
+        elif ev == 3:
+            call[pid] = call.get(pid, 0) + 1
+        elif ev == 4:
+            alloc[pid] = alloc.get(pid, 0) + arg
+    if cur is not None and evs:
+        run[cur] = run.get(cur, 0) + evs[-1][0] - since
+    total = sum(run.values()) or 1
+    print("\n pid     run[us]    cpu%  switches  wakeups  calls  alloc[B]")
+    for pid in sorted(set(run) | set(sw) | set(wake) | set(call) | set(alloc)):
+        r = run.get(pid, 0)
+        print("%4d %11.1f %7.2f %9d %8d %6d %9d" % (
+            pid, r * 1e6 / clk, 100.0 * r / total, sw.get(pid, 0),
+            wake.get(pid, 0), call.get(pid, 0), alloc.get(pid, 0)))
+    print("(pid 0 is idle, the run time counts from the first switch)")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("file")
+    ap.add_argument("--clk", type=int, default=0, help="cpu clock in Hz")
+    ap.add_argument("--stats", action="store_true", help="statistics only")
+    a = ap.parse_args()
+    with open(a.file, "rb") as f:
+        data = f.read()
+    clk, evs, lost = load(data, a.clk)
+    if lost:
+        print("# %d older events were overwritten" % lost)
+    if not a.stats and evs:
+        t0 = evs[0][0]
+        for ts, ev, pid, arg in evs:
+            print("%12.3f us  %s" % ((ts - t0) * 1e6 / clk, describe(ev, pid, arg)))
+    stats(clk, evs)
+
+
+if __name__ == "__main__":
+    main()